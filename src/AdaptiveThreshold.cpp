@@ -0,0 +1,498 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "PixelFormat.cpp"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	#define ARUCO_X86_SIMD 1
+	#include <immintrin.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Fused grayscale conversion and adaptive mean threshold.
+ * Produces the same result as cvtColor(BGR2GRAY) followed by adaptiveThreshold(ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY, C = 0) in a single sweep over the frame.
+ * Frames in other pixel formats (YUV, Bayer, 16 bit) are converted to luma by the row accessors of PixelFormat in the same sweep, luma frames are used as is.
+ * The block mean is computed from running column sums, each gray row is converted right before it enters the block window so the frame is read only once.
+ * A pixel is set to 255 when it is brighter than the mean of its block rounded to an integer (border replicated), as the 8 bit box filter used by adaptiveThreshold does.
+ * The block area is odd, so src > round(sum / area) is tested as src * area > sum + area / 2 in integer or exact float arithmetic and all kernels give bit-identical output.
+ * The SSE2 and AVX2 kernels are selected at runtime using the OpenCV CPU feature detection.
+ */
+class AdaptiveThreshold
+{
+	public:
+		/**
+		 * Kernels available to compute the threshold.
+		 */
+		enum Kernel
+		{
+			KERNEL_AUTO = 0,
+			KERNEL_SCALAR = 1,
+			KERNEL_SSE2 = 2,
+			KERNEL_AVX2 = 3
+		};
+
+		/**
+		 * Largest block size supported, the block sums of larger blocks are not exact in the float compare of the SIMD kernels (above 2^24).
+		 */
+		static const int MAX_BLOCK_SIZE = 255;
+
+		/**
+		 * Convert frame to grayscale and apply adaptive threshold.
+		 * Grayscale frames are used as is, BGR and BGRA frames are converted using the same fixed point coefficients as cvtColor.
+		 * @param frame Input frame (CV_8UC1, CV_8UC3 or CV_8UC4).
+		 * @param gray Output grayscale image.
+		 * @param binary Output binary image.
+		 * @param blockSize Size of the neighborhood used to calculate the threshold, has to be odd and at most MAX_BLOCK_SIZE.
+		 * @param kernel Kernel to be used, by default the fastest kernel supported by the CPU is used.
+		 */
+		static void apply(Mat frame, Mat &gray, Mat &binary, int blockSize, int kernel = KERNEL_AUTO)
+		{
+			vector<int> sums, prefix;
+			apply(frame, gray, binary, blockSize, sums, prefix, PixelFormat(), kernel);
+		}
+
+		/**
+		 * Convert frame to grayscale and apply adaptive threshold using caller provided scratch buffers.
+		 * The buffers only grow, when reused across frames of the same size no memory is allocated.
+		 * @param frame Input frame, image of the pixel format (see PixelFormat::plane()).
+		 * @param gray Output grayscale image, for luma frames it references the frame.
+		 * @param binary Output binary image.
+		 * @param blockSize Size of the neighborhood used to calculate the threshold, has to be odd and at most MAX_BLOCK_SIZE.
+		 * @param sums Scratch buffer for the column sums.
+		 * @param prefix Scratch buffer for the horizontal prefix sums.
+		 * @param format Pixel format of the frame.
+		 * @param kernel Kernel to be used, by default the fastest kernel supported by the CPU is used.
+		 */
+		static void apply(Mat frame, Mat &gray, Mat &binary, int blockSize, vector<int> &sums, vector<int> &prefix, const PixelFormat &format = PixelFormat(), int kernel = KERNEL_AUTO)
+		{
+			CV_Assert(format.supports(frame) && blockSize % 2 == 1 && blockSize > 1 && blockSize <= MAX_BLOCK_SIZE);
+
+			int rows = frame.rows;
+			int cols = frame.cols;
+			int radius = blockSize / 2;
+			int area = blockSize * blockSize;
+
+			if(format.isLuma(frame))
+			{
+				gray = frame;
+			}
+			else
+			{
+				gray.create(rows, cols, CV_8UC1);
+			}
+
+			binary.create(rows, cols, CV_8UC1);
+
+			if(kernel == KERNEL_AUTO)
+			{
+				kernel = selectKernel();
+			}
+
+			//Running vertical sums of each column and horizontal prefix of the sums with replicated border
+			sums.assign(cols, 0);
+			prefix.resize(cols + 2 * radius + 1);
+			prefix[0] = 0;
+
+			//Number of gray rows already converted
+			int converted = 0;
+
+			//Initial window, rows above the image replicate the first row
+			for(int k = -radius; k <= radius; k++)
+			{
+				int r = clampIndex(k, rows);
+				converted = convertRows(frame, gray, converted, r, format);
+
+				const uchar *row = gray.ptr<uchar>(r);
+				for(int x = 0; x < cols; x++)
+				{
+					sums[x] += row[x];
+				}
+			}
+
+			for(int y = 0; y < rows; y++)
+			{
+				//Horizontal prefix of the column sums
+				int *p = prefix.data();
+				for(int k = 0; k < cols + 2 * radius; k++)
+				{
+					p[k + 1] = p[k] + sums[clampIndex(k - radius, cols)];
+				}
+
+				compare(kernel, p, gray.ptr<uchar>(y), binary.ptr<uchar>(y), cols, blockSize, area);
+
+				//Slide the window one row down
+				if(y + 1 < rows)
+				{
+					int add = clampIndex(y + radius + 1, rows);
+					int sub = clampIndex(y - radius, rows);
+
+					converted = convertRows(frame, gray, converted, add, format);
+					accumulate(kernel, sums.data(), gray.ptr<uchar>(add), gray.ptr<uchar>(sub), cols);
+				}
+			}
+		}
+
+		/**
+		 * Apply the adaptive threshold with several block sizes in a single pass over a grayscale image.
+		 * All the block sizes share one integral image of the image padded with the border replicated by the largest block radius.
+		 * Only the integral rows used by the largest block are kept (ring buffer), the difference between two integral rows is the prefix used by the compare kernels.
+		 * The integral uses 32 bit wrap around arithmetic, block sums are still exact since they fit in 32 bits.
+		 * Each binary image is identical to the one obtained with apply() using the same block size.
+		 * @param gray Grayscale image (CV_8UC1).
+		 * @param blockSizes Block sizes, have to be odd and at most MAX_BLOCK_SIZE.
+		 * @param binaries Output binary image for each block size.
+		 * @param integral Scratch buffer for the integral rows.
+		 * @param prefix Scratch buffer for the prefix of the block column sums.
+		 * @param kernel Kernel to be used, by default the fastest kernel supported by the CPU is used.
+		 */
+		static void applyMulti(const Mat &gray, const vector<int> &blockSizes, vector<Mat> &binaries, vector<uint32_t> &integral, vector<int> &prefix, int kernel = KERNEL_AUTO)
+		{
+			CV_Assert(gray.type() == CV_8UC1 && !blockSizes.empty());
+
+			int rows = gray.rows;
+			int cols = gray.cols;
+			int border = 0;
+
+			for(unsigned int k = 0; k < blockSizes.size(); k++)
+			{
+				CV_Assert(blockSizes[k] % 2 == 1 && blockSizes[k] > 1 && blockSizes[k] <= MAX_BLOCK_SIZE);
+				border = max(border, blockSizes[k] / 2);
+			}
+
+			if(kernel == KERNEL_AUTO)
+			{
+				kernel = selectKernel();
+			}
+
+			binaries.resize(blockSizes.size());
+			for(unsigned int k = 0; k < blockSizes.size(); k++)
+			{
+				binaries[k].create(rows, cols, CV_8UC1);
+			}
+
+			//Integral row i is the sum of the first i rows of the padded image, with an extra zero column
+			int width = cols + 2 * border + 1;
+			int ring = 2 * border + 2;
+			integral.resize((size_t)width * ring);
+			prefix.resize(width);
+
+			fill(integral.begin(), integral.begin() + width, 0);
+			int built = 1;
+
+			for(int y = 0; y < rows; y++)
+			{
+				//Rows needed by the largest block of this row
+				for(; built <= y + 2 * border + 1; built++)
+				{
+					integralRow(gray, clampIndex(built - 1 - border, rows), border, integral.data() + (size_t)((built - 1) % ring) * width, integral.data() + (size_t)(built % ring) * width);
+				}
+
+				const uchar *src = gray.ptr<uchar>(y);
+
+				for(unsigned int k = 0; k < blockSizes.size(); k++)
+				{
+					int blockSize = blockSizes[k];
+					int radius = blockSize / 2;
+
+					//Prefix of the block column sums, starting at the left column of the block of the first pixel
+					const uint32_t *top = integral.data() + (size_t)((y + border - radius) % ring) * width + border - radius;
+					const uint32_t *bottom = integral.data() + (size_t)((y + border + radius + 1) % ring) * width + border - radius;
+					int *p = prefix.data();
+
+					for(int x = 0; x <= cols + 2 * radius; x++)
+					{
+						p[x] = (int)(bottom[x] - top[x]);
+					}
+
+					compare(kernel, p, src, binaries[k].ptr<uchar>(y), cols, blockSize, blockSize * blockSize);
+				}
+			}
+		}
+
+		/**
+		 * Convert frame to grayscale using the same coefficients as apply().
+		 * Used when the threshold is not applied to the full resolution image.
+		 * @param frame Input frame, image of the pixel format (see PixelFormat::plane()).
+		 * @param gray Output grayscale image, for luma frames it references the frame.
+		 * @param format Pixel format of the frame.
+		 */
+		static void convert(Mat frame, Mat &gray, const PixelFormat &format = PixelFormat())
+		{
+			CV_Assert(format.supports(frame));
+
+			if(format.isLuma(frame))
+			{
+				gray = frame;
+				return;
+			}
+
+			gray.create(frame.rows, frame.cols, CV_8UC1);
+			convertRows(frame, gray, 0, frame.rows - 1, format);
+		}
+
+		/**
+		 * Select the fastest kernel supported by the CPU.
+		 * Respects the cv::setUseOptimized() flag.
+		 * @return Kernel to be used.
+		 */
+		static int selectKernel()
+		{
+			#ifdef ARUCO_X86_SIMD
+				#ifdef CV_CPU_AVX2
+					if(checkHardwareSupport(CV_CPU_AVX2))
+					{
+						return KERNEL_AVX2;
+					}
+				#endif
+
+				if(checkHardwareSupport(CV_CPU_SSE2))
+				{
+					return KERNEL_SSE2;
+				}
+			#endif
+
+			return KERNEL_SCALAR;
+		}
+
+	private:
+		/**
+		 * Clamp index to the range [0, size - 1], used to replicate the border.
+		 */
+		static inline int clampIndex(int i, int size)
+		{
+			return i < 0 ? 0 : (i >= size ? size - 1 : i);
+		}
+
+		/**
+		 * Calculate the next integral row, the previous integral row plus the prefix of an image row padded with the border replicated.
+		 * @param gray Grayscale image.
+		 * @param y Image row to add.
+		 * @param border Border size on each side.
+		 * @param above Previous integral row.
+		 * @param row Output integral row.
+		 */
+		static void integralRow(const Mat &gray, int y, int border, const uint32_t *above, uint32_t *row)
+		{
+			const uchar *src = gray.ptr<uchar>(y);
+			int cols = gray.cols;
+			uint32_t sum = 0;
+
+			row[0] = 0;
+			row++;
+			above++;
+
+			for(int x = 0; x < border; x++)
+			{
+				sum += src[0];
+				row[x] = above[x] + sum;
+			}
+
+			row += border;
+			above += border;
+
+			for(int x = 0; x < cols; x++)
+			{
+				sum += src[x];
+				row[x] = above[x] + sum;
+			}
+
+			row += cols;
+			above += cols;
+
+			for(int x = 0; x < border; x++)
+			{
+				sum += src[cols - 1];
+				row[x] = above[x] + sum;
+			}
+		}
+
+		/**
+		 * Convert frame rows to gray until the row is available.
+		 * @param frame Input frame.
+		 * @param gray Gray image being filled.
+		 * @param converted Number of rows already converted.
+		 * @param row Row needed.
+		 * @param format Pixel format of the frame.
+		 * @return Number of rows converted after the call.
+		 */
+		static int convertRows(Mat &frame, Mat &gray, int converted, int row, const PixelFormat &format)
+		{
+			if(format.isLuma(frame))
+			{
+				return frame.rows;
+			}
+
+			return format.convert(frame, gray, converted, row);
+		}
+
+		/**
+		 * Add one row and subtract another from the column sums.
+		 */
+		static void accumulate(int kernel, int *sums, const uchar *add, const uchar *sub, int cols)
+		{
+			int x = 0;
+
+			#ifdef ARUCO_X86_SIMD
+				if(kernel == KERNEL_AVX2)
+				{
+					x = accumulateAVX2(sums, add, sub, cols);
+				}
+				else if(kernel == KERNEL_SSE2)
+				{
+					x = accumulateSSE2(sums, add, sub, cols);
+				}
+			#endif
+
+			for(; x < cols; x++)
+			{
+				sums[x] += add[x] - sub[x];
+			}
+		}
+
+		/**
+		 * Compare each pixel with the rounded mean of its block and write the binary row.
+		 * The block sum for pixel x is prefix[x + blockSize] - prefix[x], the half area added to it rounds the mean.
+		 */
+		static void compare(int kernel, const int *prefix, const uchar *src, uchar *dst, int cols, int blockSize, int area)
+		{
+			int x = 0;
+
+			#ifdef ARUCO_X86_SIMD
+				if(kernel == KERNEL_AVX2)
+				{
+					x = compareAVX2(prefix, src, dst, cols, blockSize, area);
+				}
+				else if(kernel == KERNEL_SSE2)
+				{
+					x = compareSSE2(prefix, src, dst, cols, blockSize, area);
+				}
+			#endif
+
+			int half = area / 2;
+
+			for(; x < cols; x++)
+			{
+				dst[x] = src[x] * area > prefix[x + blockSize] - prefix[x] + half ? 255 : 0;
+			}
+		}
+
+		#ifdef ARUCO_X86_SIMD
+			__attribute__((target("sse2")))
+			static int accumulateSSE2(int *sums, const uchar *add, const uchar *sub, int cols)
+			{
+				int x = 0;
+				__m128i zero = _mm_setzero_si128();
+
+				for(; x + 16 <= cols; x += 16)
+				{
+					__m128i a = _mm_loadu_si128((const __m128i*)(add + x));
+					__m128i s = _mm_loadu_si128((const __m128i*)(sub + x));
+
+					__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(s, zero));
+					__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(s, zero));
+					__m128i slo = _mm_cmpgt_epi16(zero, lo);
+					__m128i shi = _mm_cmpgt_epi16(zero, hi);
+
+					__m128i *out = (__m128i*)(sums + x);
+					_mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), _mm_unpacklo_epi16(lo, slo)));
+					_mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_unpackhi_epi16(lo, slo)));
+					_mm_storeu_si128(out + 2, _mm_add_epi32(_mm_loadu_si128(out + 2), _mm_unpacklo_epi16(hi, shi)));
+					_mm_storeu_si128(out + 3, _mm_add_epi32(_mm_loadu_si128(out + 3), _mm_unpackhi_epi16(hi, shi)));
+				}
+
+				return x;
+			}
+
+			__attribute__((target("sse2")))
+			static int compareSSE2(const int *prefix, const uchar *src, uchar *dst, int cols, int blockSize, int area)
+			{
+				int x = 0;
+				__m128i zero = _mm_setzero_si128();
+				__m128 scale = _mm_set1_ps((float)area);
+				__m128i half = _mm_set1_epi32(area / 2);
+
+				for(; x + 16 <= cols; x += 16)
+				{
+					__m128i pixels = _mm_loadu_si128((const __m128i*)(src + x));
+					__m128i lo = _mm_unpacklo_epi8(pixels, zero);
+					__m128i hi = _mm_unpackhi_epi8(pixels, zero);
+
+					__m128i mask[4];
+					__m128i values[4] = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+
+					for(int k = 0; k < 4; k++)
+					{
+						__m128i end = _mm_loadu_si128((const __m128i*)(prefix + x + 4 * k + blockSize));
+						__m128i begin = _mm_loadu_si128((const __m128i*)(prefix + x + 4 * k));
+						__m128 sum = _mm_cvtepi32_ps(_mm_add_epi32(_mm_sub_epi32(end, begin), half));
+						__m128 value = _mm_mul_ps(_mm_cvtepi32_ps(values[k]), scale);
+
+						mask[k] = _mm_castps_si128(_mm_cmpgt_ps(value, sum));
+					}
+
+					__m128i out = _mm_packs_epi16(_mm_packs_epi32(mask[0], mask[1]), _mm_packs_epi32(mask[2], mask[3]));
+					_mm_storeu_si128((__m128i*)(dst + x), out);
+				}
+
+				return x;
+			}
+
+			__attribute__((target("avx2")))
+			static int accumulateAVX2(int *sums, const uchar *add, const uchar *sub, int cols)
+			{
+				int x = 0;
+
+				for(; x + 8 <= cols; x += 8)
+				{
+					__m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(add + x)));
+					__m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(sub + x)));
+
+					__m256i *out = (__m256i*)(sums + x);
+					_mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out), _mm256_sub_epi32(a, s)));
+				}
+
+				return x;
+			}
+
+			__attribute__((target("avx2")))
+			static int compareAVX2(const int *prefix, const uchar *src, uchar *dst, int cols, int blockSize, int area)
+			{
+				int x = 0;
+				__m256 scale = _mm256_set1_ps((float)area);
+				__m256i half = _mm256_set1_epi32(area / 2);
+
+				for(; x + 16 <= cols; x += 16)
+				{
+					__m256i mask[2];
+
+					for(int k = 0; k < 2; k++)
+					{
+						__m256i end = _mm256_loadu_si256((const __m256i*)(prefix + x + 8 * k + blockSize));
+						__m256i begin = _mm256_loadu_si256((const __m256i*)(prefix + x + 8 * k));
+						__m256 sum = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_sub_epi32(end, begin), half));
+
+						__m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x + 8 * k)));
+						__m256 value = _mm256_mul_ps(_mm256_cvtepi32_ps(pixels), scale);
+
+						mask[k] = _mm256_castps_si256(_mm256_cmp_ps(value, sum, _CMP_GT_OQ));
+					}
+
+					//Pack 32 bit masks to bytes, packs works per 128 bit lane so the lanes are reordered
+					__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(mask[0], mask[1]), 0xD8);
+					__m128i out = _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+					_mm_storeu_si128((__m128i*)(dst + x), out);
+				}
+
+				return x;
+			}
+		#endif
+};
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <iostream>
+#include <chrono>
 #include <math.h>
 
 #include <opencv2/core/core.hpp>
@@ -9,10 +10,17 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/photo/photo.hpp>
 
+#include "AdaptiveThreshold.cpp"
+#include "DetectorContext.cpp"
+#include "ThreadPool.cpp"
 #include "SquareFinder.cpp"
+#include "CellSampler.cpp"
+#include "MarkerFamily.cpp"
+#include "MarkerTracker.cpp"
 #include "CornerRefinement.cpp"
 #include "ArucoMarker.cpp"
 #include "ArucoMarkerInfo.cpp"
+#include "math/PlanarPose.cpp"
 
 #define DEBUG false
 
@@ -27,62 +35,824 @@ using namespace std;
 class ArucoDetector
 {	
 	public:
+		/**
+		 * Methods available to read the cells of the candidates.
+		 */
+		enum DecodeMode
+		{
+			/**
+			 * Warp each candidate to a 49x49 image, resize it to the cells size and binarize it with Otsu.
+			 */
+			DECODE_WARP = 0,
+
+			/**
+			 * Sample the cells directly from the grayscale image using the closed form homography of the quad (CellSampler).
+			 */
+			DECODE_SAMPLE = 1
+		};
+
+		/**
+		 * Cosine limit used during the quad detection phase.
+		 * Higher values allow detection of more distorted markers but performance is slower.
+		 */
+		float limitCosine;
+
+		/**
+		 * Adaptive threshold block size, has to be odd.
+		 */
+		int thresholdBlockSize;
+
+		/**
+		 * Adaptive threshold block sizes, when not empty the threshold is computed for all the sizes in a single pass and quads found with each size are merged.
+		 * Replaces thresholdBlockSize, finds markers under different lighting conditions in a single frame.
+		 */
+		vector<int> thresholdBlockSizes;
+
+		/**
+		 * Minimum area considered for aruco markers.
+		 */
+		int minArea;
+
+		/**
+		 * Max error percentage relative to the square perimeter used by the polygon approximation.
+		 */
+		double maxError;
+
+		/**
+		 * Method used to read the cells of the candidates, by default DECODE_WARP is used.
+		 */
+		int decodeMode;
+
+		/**
+		 * Maximum number of wrong inner cells corrected when decoding markers (between 0 and 2).
+		 * By default 0 is used and only exact code words are accepted.
+		 */
+		int errorCorrection;
+
+		/**
+		 * Number of threads used to decode the candidate quads.
+		 * With 1 thread (default) the candidates are decoded in the calling thread.
+		 */
+		int threads;
+
+		/**
+		 * Decimation factor used to search quads (1, 2 or 4), by default 1 (disabled). Other values fail an assertion when the frame is processed.
+		 * With decimation the threshold and quad search run on the grayscale image downscaled by this factor, reducing their cost by factor^2.
+		 * The quad corners are mapped back and refined with cornerSubPix on the full resolution image, where the cells are also read.
+		 * The threshold block size and min area keep their full resolution meaning and are scaled to the decimated image.
+		 *
+		 * Markers are found only if each cell is at least 2 pixels wide in the decimated image.
+		 * The smallest detectable marker side (7 cells) is 14 * decimation pixels at full resolution: 14px without decimation, 28px with 2 and 56px with 4.
+		 */
+		int decimation;
+
+		/**
+		 * Maximum marker size in pixels (width and height of the bounding box), 0 (default) for no limit.
+		 * Contours larger than this size are discarded before the polygon approximation.
+		 */
+		int maxMarkerSize;
+
+		/**
+		 * Size of the tiles used to search quads in parallel, 0 (default) to search the whole image at once.
+		 * Tiling requires maxMarkerSize, tiles overlap by maxMarkerSize pixels so the quads found are the same as without tiling.
+		 * Tiles are processed using the detector thread pool.
+		 */
+		int tileSize;
+
+		/**
+		 * If set markers are tracked across frames, by default false.
+		 * While all tracked markers are found the pipeline only runs inside the regions predicted by the tracker, with the same decimation and threshold block sizes as the full frame.
+		 * The full frame is scanned every tracker.fullScanInterval frames and immediately (in the same frame) when a tracked marker is lost.
+		 */
+		bool tracking;
+
+		/**
+		 * If set the corners of the markers found are refined with subpixel precision, by default false.
+		 * The four edges of each marker are located along gradient profiles and the corners are the intersections of the fitted lines (CornerRefinement::refineEdges).
+		 * Reduces the jitter of the corners (and of the pose) caused by the integer vertices of the polygon approximation.
+		 */
+		bool refineCorners;
+
+		/**
+		 * If set (default) quads nested inside a quad that was decoded as a marker are not decoded.
+		 * Each physical marker produces a single candidate, the inner contours of the marker (border and cells) and the quads found again with other threshold block sizes are dropped before decoding.
+		 * The number of quads suppressed in the last frame is available in context.suppressed.
+		 */
+		bool suppressDuplicates;
+
+		/**
+		 * Pixel format of the frames, by default selected from the type of the frame (grayscale, BGR or BGRA).
+		 * Mono, YUV (NV12, YUYV, UYVY), Bayer and 16 bit frames are read directly, only their luma is used and no color conversion is done.
+		 */
+		PixelFormat pixelFormat;
+
+		/**
+		 * Tracker used when tracking is enabled.
+		 */
+		MarkerTracker tracker;
+
+		/**
+		 * Marker families decoded by the detector.
+		 * When empty (default) only the original aruco markers are decoded using the decodeMode and errorCorrection options.
+		 * Otherwise all the candidates are sampled with the CellSampler and tested against each registered family.
+		 */
+		FamilyRegistry families;
+
+		/**
+		 * Workspace with all the buffers used to process frames, reused across frames.
+		 */
+		DetectorContext context;
+
+		/**
+		 * Thread pool used to decode candidates, created when more than one thread is used.
+		 * Can be shared between detectors using setThreadPool().
+		 */
+		shared_ptr<ThreadPool> pool;
+
+		/**
+		 * Aruco detector constructor.
+		 * @param limitCosine Higher values allow detection of more distorted markers but performance is slower
+		 * @param thresholdBlockSize Adaptive threshold block size.
+		 * @param minArea Minimum area of the markers.
+		 * @param maxError Max error percentage relative to the square perimeter.
+		 */
+		ArucoDetector(float _limitCosine = 0.7, int _thresholdBlockSize = 7, int _minArea = 100, double _maxError = 0.025)
+		{
+			limitCosine = _limitCosine;
+			thresholdBlockSize = _thresholdBlockSize;
+			minArea = _minArea;
+			maxError = _maxError;
+			threads = 1;
+			decimation = 1;
+			maxMarkerSize = 0;
+			tileSize = 0;
+			tracking = false;
+			refineCorners = false;
+			suppressDuplicates = true;
+			decodeMode = DECODE_WARP;
+			errorCorrection = 0;
+			pixelFormat = PixelFormat();
+		}
+
+		/**
+		 * Use a existing thread pool to decode candidates, the threads option is set to the pool size.
+		 * @param _pool Thread pool to use.
+		 */
+		void setThreadPool(shared_ptr<ThreadPool> _pool)
+		{
+			pool = _pool;
+			threads = pool->size();
+		}
+
+		/**
+		 * Get the thread pool, it is created (or replaced) when its size does not match the threads option.
+		 * @return Thread pool.
+		 */
+		ThreadPool &getPool()
+		{
+			if(!pool || (int)pool->size() != max(threads, 1))
+			{
+				pool = make_shared<ThreadPool>(max(threads, 1));
+			}
+
+			return *pool;
+		}
+
 		/**
 		 * Process image to identify aruco markers.
 		 * Applies pre-processing over the frame and get list of quads in the frame.
+		 * All the buffers used are kept in the detector context and reused in the next frame.
+		 * @param frame Frame to be processed.
+		 * @return Markers found, the vector is owned by the context and is valid until the next call.
+		 */
+		vector<ArucoMarker> &detect(Mat frame)
+		{
+			bool scanned = false;
+
+			if(tracking && !tracker.needsFullScan())
+			{
+				detectRegions(frame);
+				scanned = tracker.update(context.markers, false);
+			}
+
+			if(!scanned)
+			{
+				detectFrame(frame);
+
+				if(tracking)
+				{
+					tracker.update(context.markers, true);
+				}
+			}
+
+			context.track();
+
+			return context.markers;
+		}
+
+		/**
+		 * Search markers in the full frame.
+		 * Runs the preprocess, quad search and decode stages, they can also be called separately (e.g. from different threads) as long as they are called in order for each frame.
 		 * @param frame Frame to be processed.
-		 * @param limitCosine Higher values allow detection of more distorted markers but performance is slower
 		 */
-		static vector<ArucoMarker> getMarkers(Mat frame, float limitCosine = 0.7, int thresholdBlockSize = 7, int minArea = 100, double maxError = 0.025)
+		void detectFrame(Mat frame)
 		{
-			//Create a grayscale image
-			Mat gray;
-			cvtColor(frame, gray, COLOR_BGR2GRAY);
+			preprocess(frame);
+			searchQuads();
+			decode(context.gray);
+		}
+
+		/**
+		 * First stage of the full frame search, converts the frame to grayscale (decimated if enabled) and applies the adaptive threshold.
+		 * The frame has to be in the pixel format of the detector.
+		 * The results are stored in the context.
+		 * @param frame Frame to be processed.
+		 */
+		void preprocess(Mat frame)
+		{
+			CV_Assert(decimation == 1 || decimation == 2 || decimation == 4);
+
+			int factor = decimation;
+			bool multiple = !thresholdBlockSizes.empty();
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-			//Adaptive threshold
-			Mat thresh;
-			adaptiveThreshold(gray, thresh, 255, THRESH_BINARY, ADAPTIVE_THRESH_MEAN_C, thresholdBlockSize, 0.0);
+			//Frames without a luma plane are converted into the luma buffer
+			frame = pixelFormat.plane(frame);
+			bool luma = pixelFormat.isLuma(frame);
+			context.gray = luma ? frame : context.luma;
+
+			if(factor > 1 || multiple)
+			{
+				AdaptiveThreshold::convert(frame, context.gray, pixelFormat);
+				context.timings.convert = elapsed(start);
+
+				//Threshold the decimated image, the block sizes are given in full resolution pixels
+				Mat source = context.gray;
+				if(factor > 1)
+				{
+					resize(context.gray, context.decimated, Size(frame.cols / factor, frame.rows / factor), 0, 0, INTER_AREA);
+					source = context.decimated;
+				}
+
+				if(multiple)
+				{
+					scaleBlockSizes(factor);
+					AdaptiveThreshold::applyMulti(source, context.blockSizes, context.thresholds, context.integral, context.prefix);
+				}
+				else
+				{
+					AdaptiveThreshold::apply(source, source, context.thresh, max(3, (thresholdBlockSize / factor) | 1), context.sums, context.prefix);
+				}
+			}
+			else
+			{
+				//Grayscale conversion and adaptive threshold in a single pass
+				AdaptiveThreshold::apply(frame, context.gray, context.thresh, thresholdBlockSize, context.sums, context.prefix, pixelFormat);
+				context.timings.convert = 0.0;
+			}
+
+			context.timings.threshold = elapsed(start);
+
+			if(!luma)
+			{
+				context.luma = context.gray;
+			}
 
 			#if DEBUG
-				imshow("Adaptive", thresh);
+				imshow("Adaptive", multiple ? context.thresholds[0] : context.thresh);
 			#endif
+		}
 
-			//Get quads
-			vector<Quadrilateral> quads = SquareFinder::findSquares(thresh, limitCosine, minArea, maxError);
+		/**
+		 * Second stage of the full frame search, finds the quads in the binary images of the context.
+		 * Has to be called after preprocess() with the same options.
+		 */
+		void searchQuads()
+		{
+			int factor = max(decimation, 1);
+			bool multiple = !thresholdBlockSizes.empty();
+
+			context.squareStats.reset();
+
+			//Time spent merging and refining the quads, counted as quad filtering
+			double merge = 0.0;
+
+			//Get quads, quads found with more than one block size are merged
+			if(multiple)
+			{
+				context.quads.clear();
+
+				for(unsigned int i = 0; i < context.thresholds.size(); i++)
+				{
+					findQuads(context.thresholds[i], context.blockQuads, factor);
+
+					chrono::steady_clock::time_point start = chrono::steady_clock::now();
+					mergeQuads(context.blockQuads, context.quads);
+					merge += elapsed(start);
+				}
+			}
+			else
+			{
+				findQuads(context.thresh, context.quads, factor);
+			}
+
+			if(factor > 1)
+			{
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				refineDecimatedCorners(factor);
+				merge += elapsed(start);
+			}
+
+			context.timings.contours = context.squareStats.contourTime;
+			context.timings.quads = context.squareStats.quadTime + merge;
 
 			#if DEBUG
-				Mat quad = frame.clone();
-				SquareFinder::drawQuads(quad, quads);
+				Mat quad;
+				cvtColor(context.gray, quad, COLOR_GRAY2BGR);
+				SquareFinder::drawQuads(quad, context.quads);
 				imshow("Quads", quad);
 			#endif
+		}
+
+		/**
+		 * Search markers only inside the regions predicted by the tracker.
+		 * Each region goes through the same steps as the full frame (grayscale conversion, decimation, threshold with every block size and quad search), the quads are then decoded together.
+		 * Pixels outside of the regions are left untouched in the gray buffer. Without decimation and multiple block sizes the same holds for the binary buffer, otherwise the binary buffers hold the last region.
+		 * @param frame Frame to be processed.
+		 */
+		void detectRegions(Mat frame)
+		{
+			CV_Assert(decimation == 1 || decimation == 2 || decimation == 4);
 
-			//List of markers
-			vector<ArucoMarker> markers = vector<ArucoMarker>();
+			int factor = decimation;
+			bool multiple = !thresholdBlockSizes.empty();
 
-			//Transform quads and filter invalid markers
-			for(unsigned int i = 0; i < quads.size(); i++)
+			frame = pixelFormat.plane(frame);
+			bool luma = pixelFormat.isLuma(frame);
+
+			tracker.predict(frame.size(), context.regions);
+
+			context.gray = luma ? frame : context.luma;
+			context.gray.create(frame.rows, frame.cols, CV_8UC1);
+			context.quads.clear();
+			context.squareStats.reset();
+			context.timings.reset();
+
+			if(multiple)
 			{
+				scaleBlockSizes(factor);
+			}
 
-				Mat board = deformQuad(frame, Point2i(49, 49), quads[i].points);
-				Mat binary = processArucoImage(board);
+			int maxSize = maxMarkerSize > 0 ? (maxMarkerSize + factor - 1) / factor : 0;
+			double merge = 0.0;
 
-				//Process aruco image and get data
-				ArucoMarker marker = readArucoData(binary);
-				marker.projected = quads[i].points;
-
-				//Check if marker is valid
-				if(marker.validate())
-				{					
-					//Show board
-					#if DEBUG
-						imshow("Board", board);
-					#endif
-
-					markers.push_back(marker);
+			for(unsigned int i = 0; i < context.regions.size(); i++)
+			{
+				Rect region = context.regions[i];
+				Mat gray = context.gray(region);
+
+				//Regions too small to be decimated cannot hold a marker
+				if(region.width / factor < 3 || region.height / factor < 3)
+				{
+					continue;
+				}
+
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+				Mat source = gray;
+				Mat binary;
+				if(factor > 1 || multiple)
+				{
+					AdaptiveThreshold::convert(frame(region), gray, pixelFormat);
+
+					if(factor > 1)
+					{
+						resize(gray, context.decimated, Size(region.width / factor, region.height / factor), 0, 0, INTER_AREA);
+						source = context.decimated;
+					}
+
+					if(multiple)
+					{
+						AdaptiveThreshold::applyMulti(source, context.blockSizes, context.thresholds, context.integral, context.prefix);
+					}
+					else
+					{
+						AdaptiveThreshold::apply(source, source, context.thresh, max(3, (thresholdBlockSize / factor) | 1), context.sums, context.prefix);
+						binary = context.thresh;
+					}
+				}
+				else
+				{
+					context.thresh.create(frame.rows, frame.cols, CV_8UC1);
+					binary = context.thresh(region);
+					AdaptiveThreshold::apply(frame(region), gray, binary, thresholdBlockSize, context.sums, context.prefix, pixelFormat);
+				}
+
+				context.timings.threshold += elapsed(start);
+
+				//Quads found with more than one block size are merged
+				if(multiple)
+				{
+					context.regionQuads.clear();
+
+					for(unsigned int j = 0; j < context.thresholds.size(); j++)
+					{
+						SquareFinder::findSquares(context.thresholds[j], context.blockQuads, context.contours, context.approx, limitCosine, minArea / (factor * factor), maxError, maxSize, &context.squareStats);
+
+						start = chrono::steady_clock::now();
+						mergeQuads(context.blockQuads, context.regionQuads);
+						merge += elapsed(start);
+					}
+				}
+				else
+				{
+					SquareFinder::findSquares(binary, context.regionQuads, context.contours, context.approx, limitCosine, minArea / (factor * factor), maxError, maxSize, &context.squareStats);
+				}
+
+				//Map the corners to full resolution frame coordinates
+				float sx = (float)region.width / source.cols;
+				float sy = (float)region.height / source.rows;
+
+				for(unsigned int j = 0; j < context.regionQuads.size(); j++)
+				{
+					Quadrilateral quad = context.regionQuads[j];
+
+					for(unsigned int k = 0; k < 4; k++)
+					{
+						Point2f p = quad.points[k];
+						quad.points[k] = Point2f(region.x + (p.x + 0.5f) * sx - 0.5f, region.y + (p.y + 0.5f) * sy - 0.5f);
+					}
+
+					context.quads.push_back(quad);
+				}
+			}
+
+			if(factor > 1)
+			{
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				refineMappedCorners(factor);
+				merge += elapsed(start);
+			}
+
+			if(!luma)
+			{
+				context.luma = context.gray;
+			}
+
+			context.timings.contours = context.squareStats.contourTime;
+			context.timings.quads = context.squareStats.quadTime + merge;
+
+			decode(context.gray);
+		}
+
+		/**
+		 * Scale the threshold block sizes to the decimated image, the scaled sizes are stored in the context without duplicates.
+		 * @param factor Decimation factor.
+		 */
+		void scaleBlockSizes(int factor)
+		{
+			context.blockSizes.clear();
+
+			for(unsigned int i = 0; i < thresholdBlockSizes.size(); i++)
+			{
+				int blockSize = max(3, (thresholdBlockSizes[i] / factor) | 1);
+				if(find(context.blockSizes.begin(), context.blockSizes.end(), blockSize) == context.blockSizes.end())
+				{
+					context.blockSizes.push_back(blockSize);
+				}
+			}
+		}
+
+		/**
+		 * Search quads in a binary image, tiled when a tile size is set.
+		 * @param binary Binary image.
+		 * @param quads Output quads.
+		 * @param factor Decimation factor of the binary image, sizes are scaled to the decimated image.
+		 */
+		void findQuads(Mat binary, vector<Quadrilateral> &quads, int factor)
+		{
+			int maxSize = maxMarkerSize > 0 ? (maxMarkerSize + factor - 1) / factor : 0;
+
+			if(tileSize > 0 && maxSize > 0)
+			{
+				SquareFinder::findSquaresTiled(binary, quads, getPool(), context.contourWorkspaces, context.tiles, max(tileSize / factor, 1), maxSize, limitCosine, minArea / (factor * factor), maxError, &context.squareStats);
+			}
+			else
+			{
+				SquareFinder::findSquares(binary, quads, context.contours, context.approx, limitCosine, minArea / (factor * factor), maxError, maxSize, &context.squareStats);
+			}
+		}
+
+		/**
+		 * Add quads found with one threshold block size to the quads found with the previous block sizes.
+		 * Quads with all corners within 10% of the side of a previous quad are the same candidate and are not added.
+		 * Quads found with the same block size are never merged (e.g. the outer and inner edges of the marker border).
+		 * @param found Quads found with one block size.
+		 * @param quads Quads found so far.
+		 */
+		static void mergeQuads(const vector<Quadrilateral> &found, vector<Quadrilateral> &quads)
+		{
+			unsigned int previous = quads.size();
+
+			for(unsigned int i = 0; i < found.size(); i++)
+			{
+				float tolerance = max(found[i].perimeter() * 0.25f * 0.1f, 1.0f);
+				bool duplicate = false;
+
+				for(unsigned int j = 0; j < previous && !duplicate; j++)
+				{
+					duplicate = found[i].matches(quads[j], tolerance);
+				}
+
+				if(!duplicate)
+				{
+					quads.push_back(found[i]);
+				}
+			}
+		}
+
+		/**
+		 * Map the corners of the quads found in the decimated image to full resolution and refine them.
+		 * Pixel centers are mapped to full resolution pixel centers, the refinement window is large enough to cover the decimation error.
+		 * @param factor Decimation factor used.
+		 */
+		void refineDecimatedCorners(int factor)
+		{
+			float sx = (float)context.gray.cols / context.decimated.cols;
+			float sy = (float)context.gray.rows / context.decimated.rows;
+
+			for(unsigned int i = 0; i < context.quads.size(); i++)
+			{
+				for(unsigned int k = 0; k < 4; k++)
+				{
+					Point2f p = context.quads[i].points[k];
+					context.quads[i].points[k] = Point2f((p.x + 0.5f) * sx - 0.5f, (p.y + 0.5f) * sy - 0.5f);
+				}
+			}
+
+			refineMappedCorners(factor);
+		}
+
+		/**
+		 * Refine the corners of the quads mapped from a decimated image in the full resolution grayscale image.
+		 * @param factor Decimation factor used.
+		 */
+		void refineMappedCorners(int factor)
+		{
+			context.corners.clear();
+
+			for(unsigned int i = 0; i < context.quads.size(); i++)
+			{
+				for(unsigned int k = 0; k < 4; k++)
+				{
+					context.corners.push_back(context.quads[i].points[k]);
 				}
 			}
 
-			return markers;
+			if(context.corners.empty())
+			{
+				return;
+			}
+
+			cornerSubPix(context.gray, context.corners, Size(factor + 1, factor + 1), Size(-1, -1), TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 10, 0.01));
+
+			for(unsigned int i = 0; i < context.quads.size(); i++)
+			{
+				for(unsigned int k = 0; k < 4; k++)
+				{
+					context.quads[i].points[k] = context.corners[i * 4 + k];
+				}
+			}
+		}
+
+		/**
+		 * Decode all the quads found in the frame and store the valid markers in the context.
+		 * Candidates are decoded in parallel when more than one thread is used, each candidate writes to its own slot so the markers are returned in the same order as the serial path.
+		 *
+		 * When suppressDuplicates is set the quads are decoded in passes by nesting level (outer quads first).
+		 * Quads whose center is inside a quad that was decoded as a marker (its inner border, cells, or duplicates from other block sizes) are not decoded, they are counted in context.suppressed.
+		 * @param gray Grayscale image used to read the markers.
+		 */
+		void decode(Mat gray)
+		{
+			int count = context.quads.size();
+			int levels = 1;
+			bool nested = suppressDuplicates && count > 1;
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			context.prepareDecode(threads > 1 ? getPool().size() : 1);
+			context.levels.assign(count, 0);
+			context.suppressed = 0;
+
+			if(nested)
+			{
+				levels = nestQuads(gray.size());
+			}
+
+			for(int level = 0; level < levels; level++)
+			{
+				context.batch.clear();
+
+				for(int i = 0; i < count; i++)
+				{
+					if(context.levels[i] != level)
+					{
+						continue;
+					}
+
+					//Owner was decoded as a marker or is inside one
+					int owner = nested ? context.owners[i] : -1;
+					if(owner >= 0 && (context.valid[owner] || context.levels[owner] < 0))
+					{
+						context.levels[i] = -1;
+						context.suppressed++;
+						continue;
+					}
+
+					context.batch.push_back(i);
+				}
+
+				decodeBatch(gray);
+			}
+
+			//Collect valid markers in the candidates order
+			context.markers.clear();
+			for(int i = 0; i < count; i++)
+			{
+				if(context.valid[i])
+				{
+					context.markers.push_back(context.candidates[i]);
+				}
+			}
+
+			if(refineCorners)
+			{
+				refineMarkers(gray);
+			}
+
+			context.timings.decode = elapsed(start);
+		}
+
+		/**
+		 * Refine the corners of all the markers found in a single batch.
+		 * Only the accepted markers are refined, the corners are gathered in the context, refined together and written back.
+		 * @param gray Grayscale image.
+		 */
+		void refineMarkers(Mat gray)
+		{
+			int count = context.markers.size();
+
+			if(count == 0)
+			{
+				return;
+			}
+
+			context.corners.resize(count * 4);
+			for(int i = 0; i < count; i++)
+			{
+				for(int k = 0; k < 4; k++)
+				{
+					context.corners[i * 4 + k] = context.markers[i].projected[k];
+				}
+			}
+
+			CornerRefinement::refineEdges(gray, context.corners.data(), count, context.edges);
+
+			for(int i = 0; i < count; i++)
+			{
+				context.markers[i].setProjected(&context.corners[i * 4]);
+			}
+		}
+
+		/**
+		 * Decode the quads listed in the context batch.
+		 * @param gray Grayscale image used to read the markers.
+		 */
+		void decodeBatch(Mat gray)
+		{
+			int count = context.batch.size();
+
+			if(threads > 1 && count > 1)
+			{
+				pool->parallelFor(count, [this, gray](int index, int worker)
+				{
+					decodeCandidate(gray, context.batch[index], context.workspaces[worker]);
+				});
+			}
+			else
+			{
+				for(int i = 0; i < count; i++)
+				{
+					decodeCandidate(gray, context.batch[i], context.workspaces[0]);
+				}
+			}
+		}
+
+		/**
+		 * Find the quad that owns each quad (the smallest larger quad that contains its center) and the nesting level of each quad.
+		 * Uses a grid over the quads bounding boxes so that each quad is only tested against the quads around its center.
+		 * @param size Size of the image.
+		 * @return Number of nesting levels.
+		 */
+		int nestQuads(Size size)
+		{
+			int count = context.quads.size();
+			int levels = 1;
+
+			context.grid.build(context.quads, size);
+			context.owners.resize(count);
+
+			for(int i = 0; i < count; i++)
+			{
+				context.owners[i] = context.grid.owner(context.quads, i);
+			}
+
+			//Owners are always larger, the chains have no cycles
+			for(int i = 0; i < count; i++)
+			{
+				int level = 0;
+				for(int owner = context.owners[i]; owner >= 0; owner = context.owners[owner])
+				{
+					level++;
+				}
+
+				context.levels[i] = level;
+				levels = max(levels, level + 1);
+			}
+
+			return levels;
+		}
+
+		/**
+		 * Transform one quad and check if its a valid marker.
+		 * @param gray Grayscale image used to read the marker.
+		 * @param index Index of the quad in the context.
+		 * @param workspace Buffers of the thread decoding the candidate.
+		 */
+		void decodeCandidate(Mat gray, int index, DecoderWorkspace &workspace)
+		{
+			ArucoMarker &marker = context.candidates[index];
+			marker = ArucoMarker();
+
+			if(!families.empty())
+			{
+				context.valid[index] = families.decode(gray, context.quads[index].points, marker);
+				return;
+			}
+
+			if(decodeMode == DECODE_SAMPLE)
+			{
+				//Read cells directly from the grayscale image
+				int cells[49];
+				if(!CellSampler::read(gray, context.quads[index].points, 7, cells))
+				{
+					context.valid[index] = false;
+					return;
+				}
+
+				for(unsigned int i = 0; i < 49; i++)
+				{
+					marker.setCell(i / 7, i % 7, cells[i]);
+				}
+			}
+			else
+			{
+				deformQuad(gray, Size(49, 49), context.quads[index].points, workspace.board);
+				processArucoImage(workspace.board, workspace.cells, workspace.binary);
+
+				//Process aruco image and get data
+				readArucoData(workspace.binary, marker);
+			}
+
+			marker.setProjected(context.quads[index].points);
+
+			//Check if marker is valid
+			context.valid[index] = marker.validate(errorCorrection);
+
+			//Show board, only from the calling thread
+			#if DEBUG
+				if(context.valid[index] && threads <= 1)
+				{
+					imshow("Board", workspace.board);
+				}
+			#endif
+		}
+
+		/**
+		 * Process image to identify aruco markers.
+		 * Applies pre-processing over the frame and get list of quads in the frame.
+		 * Creates a new detector for each call, to reuse buffers across frames use an ArucoDetector instance.
+		 * @param frame Frame to be processed.
+		 * @param limitCosine Higher values allow detection of more distorted markers but performance is slower
+		 * @param refineCorners If set the corners of the markers are refined with subpixel precision.
+		 */
+		static vector<ArucoMarker> getMarkers(Mat frame, float limitCosine = 0.7, int thresholdBlockSize = 7, int minArea = 100, double maxError = 0.025, bool refineCorners = false)
+		{
+			ArucoDetector detector(limitCosine, thresholdBlockSize, minArea, maxError);
+			detector.refineCorners = refineCorners;
+			return detector.detect(frame);
 		}
 
 		/**
@@ -92,16 +862,29 @@ class ArucoDetector
 		 */
 		static Mat processArucoImage(Mat image)
 		{
-			Mat aruco;
-			resize(image, aruco, Size(7, 7));
+			Mat aruco, binary;
+			processArucoImage(image, aruco, binary);
+			return binary;
+		}
 
-			Mat gray;
-			cvtColor(aruco, gray, CV_RGB2GRAY);
+		/**
+		 * Get aruco marker bits data into caller provided buffers.
+		 * @param image Square image (grayscale or BGR) with the aruco marker.
+		 * @param aruco Buffer for the image resized to the cells size.
+		 * @param binary Output binary image with the aruco code.
+		 */
+		static void processArucoImage(Mat image, Mat &aruco, Mat &binary)
+		{
+			resize(image, aruco, Size(7, 7));
 
-			Mat binary;
-			threshold(gray, binary, 0, 255, CV_THRESH_BINARY | CV_THRESH_OTSU);;
+			if(aruco.channels() != 1)
+			{
+				Mat gray;
+				cvtColor(aruco, gray, CV_RGB2GRAY);
+				aruco = gray;
+			}
 
-			return binary;
+			threshold(aruco, binary, 0, 255, CV_THRESH_BINARY | CV_THRESH_OTSU);
 		}
 
 		/**
@@ -112,17 +895,47 @@ class ArucoDetector
 		static ArucoMarker readArucoData(Mat binary)
 		{
 			ArucoMarker marker = ArucoMarker();
+			readArucoData(binary, marker);
+			return marker;
+		}
 
+		/**
+		 * Read aruco data from binary image into a existing marker.
+		 * @param binary Binary image containing aruco info.
+		 * @param marker Marker where to write the cells.
+		 */
+		static void readArucoData(Mat binary, ArucoMarker &marker)
+		{
 			for(unsigned int i = 0; i < binary.cols * binary.rows ; i++)
 			{
-				marker.cells[i / binary.cols][i % binary.cols] = (binary.data[i] == 255);
+				marker.setCell(i / binary.cols, i % binary.cols, binary.data[i] == 255);
 			}
+		}
 
-			return marker;
+		/**
+		 * Estimate the pose of each marker relative to the camera using the closed form planar solver.
+		 * The pose places the marker center in the origin (ignoring the marker world position), both flip ambiguous solutions are kept in the solver.
+		 * @param markers Vector with all aruco markers found.
+		 * @param camera Camera intrinsic calibration matrix.
+		 * @param distortion Camera distortion calibration matrix.
+		 * @param solver Solver where the poses are stored, in the same order as the markers.
+		 * @return Number of markers with a valid pose.
+		 */
+		static int estimatePoses(const vector<ArucoMarker> &markers, Mat camera, Mat distortion, PlanarPoseSolver &solver)
+		{
+			solver.clear();
+
+			for(unsigned int i = 0; i < markers.size(); i++)
+			{
+				solver.add(markers[i].projected, markers[i].info.size);
+			}
+
+			return solver.solve(camera, distortion);
 		}
 
 		/**
 		 * Draw the border and id of all markers found on top of camera image.
+		 * The axis of each marker are drawn in the marker center.
 		 * @param frame Image where to write Aruco information.
 		 * @param markers Vector with all aruco markers found.
 		 * @param camera Camera intrinsic calibration matrix.
@@ -130,6 +943,9 @@ class ArucoDetector
 		 */
 		static void drawMarkers(Mat frame, vector<ArucoMarker> markers, Mat camera, Mat distortion)
 		{
+			PlanarPoseSolver solver;
+			estimatePoses(markers, camera, distortion, solver);
+
 			for(unsigned int i = 0; i < markers.size(); i++)
 			{
 				Point2f center;
@@ -145,15 +961,18 @@ class ArucoDetector
 				center.x /= 4;
 				center.y /= 4;
 
+				//Draw number
+				putText(frame, to_string(markers[i].id), center, FONT_HERSHEY_SIMPLEX, 0.5, Scalar(0, 255, 255), 1);
+
+				if(!solver.valid[i])
+				{
+					continue;
+				}
+
 				//Draw referencial
-				Mat rotation, position;
-
-				#if CV_MAJOR_VERSION == 2
-					solvePnP(markers[i].info.world, markers[i].projected, camera, distortion, rotation, position, false, ITERATIVE);
-				#else
-					solvePnP(markers[i].info.world, markers[i].projected, camera, distortion, rotation, position, false, SOLVEPNP_ITERATIVE);
-				#endif
-				
+				Mat rotation = solver.first[i].rotationVector();
+				Mat position = solver.first[i].translationVector();
+
 				vector<Point3d> referencial;
 				referencial.push_back(Point3d(0, 0, 0));
 				referencial.push_back(Point3d(markers[i].info.size / 2, 0, 0));
@@ -171,9 +990,6 @@ class ArucoDetector
 			
 				line(frame, projected[0], projected[3], Scalar(255, 0, 0), 2);
 				putText(frame, "Z", projected[3], FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 0, 0), 1);
-
-				//Draw number
-				putText(frame, to_string(markers[i].id), center, FONT_HERSHEY_SIMPLEX, 0.5, Scalar(0, 255, 255), 1);
 			}
 		}
 
@@ -197,7 +1013,7 @@ class ArucoDetector
 
 			for(unsigned int i = 0; i < markers.size(); i++)
 			{
-				for(unsigned int k = 0; k < markers[i].projected.size(); k++)
+				for(unsigned int k = 0; k < 4; k++)
 				{
 					world.push_back(markers[i].info.world[k]);
 					image.push_back(markers[i].projected[k]);
@@ -218,6 +1034,20 @@ class ArucoDetector
 				solvePnP(world, image, camera, distortion, rotation, position, false, SOLVEPNP_ITERATIVE);
 			#endif
 
+			drawOrigin(frame, rotation, position, camera, distortion, size);
+		}
+
+		/**
+		 * Draw origin of the referencial for a known camera pose.
+		 * @param frame Image where to write origin referencial.
+		 * @param rotation Rotation of the world relative to the camera (Rodrigues).
+		 * @param position Position of the world relative to the camera.
+		 * @param camera Camera intrinsic calibration matrix.
+		 * @param distortion Camera distortion calibration matrix.
+		 * @param size Size of the referencial.
+		 */
+		static void drawOrigin(Mat frame, Mat rotation, Mat position, Mat camera, Mat distortion, float size = 1)
+		{
 			vector<Point3d> referencial;
 			referencial.push_back(Point3d(0, 0, 0));
 			referencial.push_back(Point3d(size, 0, 0));
@@ -264,13 +1094,13 @@ class ArucoDetector
 		 */
 		static Mat drawArucoMarker(ArucoMarker marker, Size size)
 		{
-			Mat out = Mat::zeros(7, 7, CV_8UC1);
+			Mat out = Mat::zeros(marker.size, marker.size, CV_8UC1);
 
-			for(unsigned int i = 0; i < 7; i++)
+			for(int i = 0; i < marker.size; i++)
 			{
-				for(unsigned int j = 0; j < 7; j++)
+				for(int j = 0; j < marker.size; j++)
 				{
-					out.data[i * 7 + j] = marker.cells[i][j] * 255;
+					out.data[i * marker.size + j] = marker.cell(i, j) * 255;
 				}
 			}
 
@@ -324,19 +1154,42 @@ class ArucoDetector
 		 * @param quad Quad that defines the square area.
 		 * @return Corrected image.
 		 */
-		static Mat deformQuad(Mat image, Point2i size, vector<Point2f> quad)
+		static Mat deformQuad(Mat image, Point2i size, const Point2f quad[4])
 		{
-			Mat out = Mat::zeros(size.x, size.y, CV_8UC3);
+			Mat out;
+			deformQuad(image, Size(size.y, size.x), quad, out);
+			return out;
+		}
 
-			vector<Point2f> points;
-			points.push_back(Point2f(0, 0));
-			points.push_back(Point2f(0, out.rows));
-			points.push_back(Point2f(out.cols, out.rows));
-			points.push_back(Point2f(out.cols, 0));
+		/**
+		 * Apply inverse perspective transformation to image using quad into a caller provided buffer.
+		 * @param image Image to transform.
+		 * @param size Size of the output image.
+		 * @param quad Quad that defines the square area.
+		 * @param out Output image, only allocated if it does not have the right size and type.
+		 */
+		static void deformQuad(Mat image, Size size, const Point2f quad[4], Mat &out)
+		{
+			Point2f points[4];
+			points[0] = Point2f(0, 0);
+			points[1] = Point2f(0, size.height);
+			points[2] = Point2f(size.width, size.height);
+			points[3] = Point2f(size.width, 0);
 
 			Mat transformation = getPerspectiveTransform(quad, points);
-			warpPerspective(image, out, transformation, out.size(), INTER_LINEAR);
+			warpPerspective(image, out, transformation, size, INTER_LINEAR);
+		}
 
-			return out;
+		/**
+		 * Time elapsed since a time point, the time point is moved to the current time so the next stage can be measured from it.
+		 * @param start Start of the stage.
+		 * @return Time elapsed in seconds.
+		 */
+		static double elapsed(chrono::steady_clock::time_point &start)
+		{
+			chrono::steady_clock::time_point now = chrono::steady_clock::now();
+			double seconds = chrono::duration<double>(now - start).count();
+			start = now;
+			return seconds;
 		}
 };
@@ -3,26 +3,41 @@
 #include <string>
 #include <iostream>
 #include <math.h>
+#include <stdint.h>
 
 #include <opencv2/core/core.hpp>
 
 #include "ArucoMarkerInfo.cpp"
+#include "ArucoDictionary.cpp"
 
 using namespace cv;
 using namespace std;
 
 /**
  * Class is used to represent aruco markers.
- * All markers are assumed to be 5x5 markers capable of 1024 options, after considering rotation and error detection.
+ * By default markers are assumed to be 5x5 markers capable of 1024 options, after considering rotation and error detection.
+ * The cells are stored as a bitboard, rotation of 7x7 markers uses precomputed bit permutation tables and the hamming distance is calculated with popcount.
+ * Markers from other families (decoded by a MarkerFamily) use the same bitboard with up to 8x8 cells.
  */
 class ArucoMarker
 {
 	public:
 		/**
-		 * Contain all the cells in the marker.
-		 * Cells are encoded as [x][y] from left to right on X and from up to down on Y.
+		 * Contain all the cells in the marker, one bit per cell.
+		 * Cell [i][j] is stored in the bit i * size + j, rows from up to down and columns from left to right.
 		 */
-		int cells[7][7];
+		uint64_t bits;
+
+		/**
+		 * Number of cells per side including the border, 7 for the original aruco markers.
+		 */
+		int size;
+
+		/**
+		 * Index of the family that decoded the marker in the detector FamilyRegistry.
+		 * Always 0 when the original aruco dictionary is used.
+		 */
+		int family;
 
 		/**
 		 * Number of rows used to store data in the marker.
@@ -50,6 +65,11 @@ class ArucoMarker
 		 */
 		int validated;
 
+		/**
+		 * Number of wrong cells corrected when the marker was validated.
+		 */
+		int distance;
+
 		/**
 		 * Store info about the marker real world morphology and location.
 		 */
@@ -57,21 +77,37 @@ class ArucoMarker
 
 		/**
 		 * Projected corner points in camera coordinates.
-		 * This vector should have only 4 points.
-		 * But can be used to store extra known points for the marker.
+		 * Stored inline so that markers can be copied without heap allocation.
 		 */
-		vector<Point2f> projected;
+		Point2f projected[4];
 
 		/**
 		 * Aruco marker constructor.
 		 */
 		ArucoMarker()
 		{
+			bits = 0;
+			size = 7;
+			family = 0;
 			rows = 5;
 			cols = 5;
 			id = -1;
 			rotation = 0;
 			validated = false;
+			distance = 0;
+		}
+
+		/**
+		 * Set the projected corner points of the marker.
+		 *
+		 * @param points Array with the 4 corner points.
+		 */
+		void setProjected(const Point2f points[4])
+		{
+			for(int i = 0; i < 4; i++)
+			{
+				projected[i] = points[i];
+			}
 		}
 
 		/**
@@ -84,6 +120,48 @@ class ArucoMarker
 			info = _info;
 		}
 
+		/**
+		 * Get the value of a cell.
+		 *
+		 * @param i Row of the cell.
+		 * @param j Column of the cell.
+		 * @return 1 if the cell is white, 0 otherwise.
+		 */
+		inline int cell(int i, int j) const
+		{
+			return (int)((bits >> (i * size + j)) & 1);
+		}
+
+		/**
+		 * Set the value of a cell.
+		 *
+		 * @param i Row of the cell.
+		 * @param j Column of the cell.
+		 * @param value Value of the cell, any non zero value is white.
+		 */
+		inline void setCell(int i, int j, int value)
+		{
+			uint64_t mask = (uint64_t)1 << (i * size + j);
+			bits = value ? (bits | mask) : (bits & ~mask);
+		}
+
+		/**
+		 * Expand the bitboard into a cells matrix.
+		 * Cells are encoded as [y][x] from up to down on Y and from left to right on X.
+		 *
+		 * @param cells Matrix where to write the cells.
+		 */
+		void getCells(int cells[7][7]) const
+		{
+			for(int i = 0; i < 7; i++)
+			{
+				for(int j = 0; j < 7; j++)
+				{
+					cells[i][j] = cell(i, j);
+				}
+			}
+		}
+
 		/**
 		 * Get the id of the marker. The ID its a value between 0 and 1024.
 		 *
@@ -96,9 +174,9 @@ class ArucoMarker
 			for(int i = 1; i < 6; ++i)
 			{
 				id <<= 1;
-				id |= cells[i][2];
+				id |= cell(i, 2);
 				id <<= 1;
-				id |= cells[i][4];
+				id |= cell(i, 4);
 			}
 
 			return id;
@@ -107,46 +185,34 @@ class ArucoMarker
 		/**
 		 * Calculate all parameters and check if its a valid aruco marker.
 		 * Should be called only after projected points and cell info is added.
+		 * The id and rotation are obtained from the precomputed dictionary table, the marker is rotated to its canonical orientation.
+		 * @param maxDistance Maximum number of wrong inner cells corrected (between 0 and ArucoDictionary::MAX_RADIUS).
 		 * @return true if the marker is valid, false otherwise.
 		 */
-		bool validate()
+		bool validate(int maxDistance = 0)
 		{
 			validated = false;
 
-			//Check if there are points
-			if(projected.size() == 0)
+			//Check black border allow up to three white squares for edge light bleed cases
+			if(popcount(bits & BORDER_MASK) > 3)
 			{
 				return false;
 			}
 
-			//Check black border allow up to three white squares for edge light bleed cases
-			unsigned int bad = 0;
-			for(unsigned int i = 0; i < 7; i++)
+			//Lookup the inner data in the dictionary
+			int turns;
+			if(!ArucoDictionary::get(maxDistance).decode(ArucoDictionary::payload(bits), id, turns, distance))
 			{
-				if(cells[i][0] != 0 || cells[i][6] != 0 || cells[0][i] != 0 || cells[6][i] != 0)
-				{
-					bad++;
-					if(bad > 3)
-					{
-						return false;
-					}
-				}
+				return false;
 			}
 
-			//Check hamming distance of internal data
-			for(int j = 0; j < 4; j++)
+			for(int j = 0; j < turns; j++)
 			{
-				if(hammingDistance() == 0)
-				{
-					calculateID();
-					validated = true;
-					return true;
-				}
-
 				rotate();
 			}
 
-			return false;
+			validated = true;
+			return true;
 		}
 
 		/**
@@ -155,68 +221,87 @@ class ArucoMarker
 		 */
 		void rotate()
 		{
-			int temp[7][7];
-			int n = 7;
-
-			for (int i = 0; i < n; i++)
-			{
-				for (int j = 0; j < n; j++)
-				{
-					temp[i][j] = cells[n - j - 1][i];
-				}
-			}
-
-			for (int i = 0; i < n; i++)
-			{
-				for (int j = 0; j < n; j++)
-				{
-					cells[i][j] = temp[i][j];
-				}
-			}
-
+			bits = size == 7 ? rotateBits(bits) : rotateGrid(bits, size);
 			rotation++;
 
-			std::rotate(projected.begin(), projected.begin() + 1, projected.end());
+			std::rotate(projected, projected + 1, projected + 4);
 		}
 
 		/**
 		 * Calculates the sum of the hamming distance (number of diferent bits) for this marker relative to the ids matrix used to validate the aruco markers.
+		 * Each row of the inner 5x5 cells is compared with the closest ids row using a precomputed table.
 		 */
-		int hammingDistance()
+		int hammingDistance() const
 		{
-			int ids[4][5] = {
-				{1, 0, 0, 0, 0},
-				{1, 0, 1, 1, 1},
-				{0, 1, 0, 0, 1},
-				{0, 1, 1, 1, 0}
-			};
-
+			const Tables &tables = getTables();
 			int dist = 0;
-			int sum, minSum;
 
 			for(int i = 1; i < 6; ++i)
 			{
-				minSum = 99999;
+				dist += tables.row[(bits >> (i * 7 + 1)) & 31];
+			}
 
-				for(int j = 1; j < 5; ++j)
-				{
-					sum = 0;
+			return dist;
+		}
 
-					for(int k = 1; k < 6; ++k)
-					{
-						sum += cells[i][k] == ids[j - 1][k - 1] ? 0 : 1;
-					}
+		/**
+		 * Rotate a cells bitboard 90 degrees, cell [i][j] receives the cell [6 - j][i].
+		 * The bitboard is processed one byte at a time using precomputed permutation tables.
+		 *
+		 * @param value Bitboard to rotate.
+		 * @return Rotated bitboard.
+		 */
+		static uint64_t rotateBits(uint64_t value)
+		{
+			const Tables &tables = getTables();
+			uint64_t out = 0;
 
-					if(sum < minSum)
-					{
-						minSum = sum;
-					}
-				}
+			for(int k = 0; k < 7; k++)
+			{
+				out |= tables.rotate[k][(value >> (k * 8)) & 255];
+			}
+
+			return out;
+		}
 
-				dist += minSum;
+		/**
+		 * Rotate a cells bitboard of any size 90 degrees, cell [i][j] receives the cell [size - 1 - j][i].
+		 *
+		 * @param value Bitboard to rotate.
+		 * @param size Number of cells per side.
+		 * @return Rotated bitboard.
+		 */
+		static uint64_t rotateGrid(uint64_t value, int size)
+		{
+			uint64_t out = 0;
+
+			for(int i = 0; i < size; i++)
+			{
+				for(int j = 0; j < size; j++)
+				{
+					out |= ((value >> ((size - 1 - j) * size + i)) & 1) << (i * size + j);
+				}
 			}
 
-			return dist;
+			return out;
+		}
+
+		/**
+		 * Count the number of bits set.
+		 *
+		 * @param value Value to count bits.
+		 * @return Number of bits set.
+		 */
+		static inline int popcount(uint64_t value)
+		{
+			#if defined(__GNUC__) || defined(__clang__)
+				return __builtin_popcountll(value);
+			#else
+				value = value - ((value >> 1) & 0x5555555555555555ULL);
+				value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+				value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+				return (int)((value * 0x0101010101010101ULL) >> 56);
+			#endif
 		}
 
 		/**
@@ -226,17 +311,23 @@ class ArucoMarker
 		{
 			cout << "{" << endl;
 			cout << "    Valid: " << validated << endl;
-			cout << "    Hamming: " << hammingDistance() << endl;
+			//The hamming table is only valid for the 7x7 aruco markers
+			if(size == 7)
+			{
+				cout << "    Hamming: " << hammingDistance() << endl;
+			}
+			cout << "    Corrected: " << distance << endl;
+			cout << "    Family: " << family << endl;
 			cout << "    ID: " << id << endl;
 			cout << "    Cells: [";
-			for(int i = 0; i < 7; i++)
+			for(int i = 0; i < size; i++)
 			{
-				for(int j = 0; j < 7; j++)
+				for(int j = 0; j < size; j++)
 				{
-					cout << cells[i][j] << ", ";
+					cout << cell(i, j) << ", ";
 				}
 
-				if(i == 6)
+				if(i == size - 1)
 				{
 					cout << "]" << endl;
 				}
@@ -247,7 +338,7 @@ class ArucoMarker
 			}
 			cout << "    Rotation: " << rotation << endl;
 
-			for(unsigned int i = 0; i < projected.size(); i++)
+			for(unsigned int i = 0; i < 4; i++)
 			{
 				cout << "    Projected: " << projected[i].x << ", " << projected[i].y << endl;
 			}
@@ -256,4 +347,74 @@ class ArucoMarker
 
 			cout << "}" << endl;
 		}
+
+	private:
+		/**
+		 * Mask with the bits of the border cells.
+		 */
+		static const uint64_t BORDER_MASK = 0x1FE0C183060FFULL;
+
+		/**
+		 * Precomputed tables used to rotate and validate markers.
+		 */
+		struct Tables
+		{
+			/**
+			 * Rotated bits for each byte of the bitboard.
+			 */
+			uint64_t rotate[7][256];
+
+			/**
+			 * Hamming distance of a 5 bit row to the closest row of the ids matrix.
+			 */
+			int row[32];
+
+			Tables()
+			{
+				for(int k = 0; k < 7; k++)
+				{
+					for(int v = 0; v < 256; v++)
+					{
+						rotate[k][v] = 0;
+
+						for(int b = 0; b < 8; b++)
+						{
+							int index = k * 8 + b;
+
+							if(index < 49 && (v >> b) & 1)
+							{
+								//Cell [i][j] moves to [j][6 - i]
+								int i = index / 7;
+								int j = index % 7;
+								rotate[k][v] |= (uint64_t)1 << (j * 7 + (6 - i));
+							}
+						}
+					}
+				}
+
+				//Rows of the ids matrix, bit k is the cell k + 1 of the row
+				int ids[4] = {0x01, 0x1D, 0x12, 0x0E};
+
+				for(int v = 0; v < 32; v++)
+				{
+					row[v] = 5;
+
+					for(int w = 0; w < 4; w++)
+					{
+						row[v] = min(row[v], popcount(v ^ ids[w]));
+					}
+				}
+			}
+		};
+
+		/**
+		 * Get the precomputed tables, created on first use.
+		 *
+		 * @return Tables.
+		 */
+		static const Tables &getTables()
+		{
+			static const Tables tables;
+			return tables;
+		}
 };
@@ -41,14 +41,14 @@ class ArucoMarkerInfo
 
 		/**
 		 * World corner points calculated from position and rotation of the marker.
-		 * This vector should have only 4 points.
-		 * But can be used to store extra known points for the marker.
+		 * Stored inline so that the info can be copied without heap allocation.
 		 * World points stored in the following order: TopLeft, TopRight, BottomRight, BottomLeft.
 		 */
-		vector<Point3f> world;
+		Point3f world[4];
 
 		/**
 		 * Default constructor with id -1.
+		 * The marker is not rotated so the world points are calculated directly without the rotation matrix.
 		 */
 		ArucoMarkerInfo()
 		{
@@ -56,8 +56,7 @@ class ArucoMarkerInfo
 			size = 1.0;
 			position = Point3d(0.0, 0.0, 0.0);
 			rotation = Point3d(0.0, 0.0, 0.0);
-			world = vector<Point3f>();
-			calculateWorldPoints();
+			calculateCorners();
 		}
 
 		/**
@@ -72,7 +71,6 @@ class ArucoMarkerInfo
 			size = _size;
 			position = _position;
 			rotation = Point3f(0.0, 0.0, 0.0);
-			world = vector<Point3f>();
 			calculateWorldPoints();
 		}
 
@@ -89,7 +87,6 @@ class ArucoMarkerInfo
 			size = _size;
 			position = _position;
 			rotation = _rotation;
-			world = vector<Point3f>();
 			calculateWorldPoints();
 		}
 
@@ -99,28 +96,34 @@ class ArucoMarkerInfo
 		 */
 		void calculateWorldPoints()
 		{
-			double half = size / 2.0;
-
-			world.clear();
+			calculateCorners();
 
-			world.push_back(Point3f(-half, -half, 0));
-			world.push_back(Point3f(-half, +half, 0));
-			world.push_back(Point3f(half, +half, 0));
-			world.push_back(Point3f(half, -half, 0));
-
-			Mat rot = Transformations::rotationMatrix(rotation);
+			double r[9];
+			Transformations::rotationMatrix(rotation, r);
 			
-			for(unsigned int i = 0; i < world.size(); i++)
+			for(unsigned int i = 0; i < 4; i++)
 			{
-				Mat temp = (Mat_<double>(3, 1) << world[i].x, world[i].y, world[i].z);
-				Mat transf = rot * temp;
+				double x = world[i].x, y = world[i].y, z = world[i].z;
 				
-				world[i].x = transf.at<double>(0, 0) + position.x;
-				world[i].y = transf.at<double>(1, 0) + position.y;
-				world[i].z = transf.at<double>(2, 0) - position.z;
+				world[i].x = r[0] * x + r[1] * y + r[2] * z + position.x;
+				world[i].y = r[3] * x + r[4] * y + r[5] * z + position.y;
+				world[i].z = r[6] * x + r[7] * y + r[8] * z - position.z;
 			}
 		}
 
+		/**
+		 * Set the world points to the marker corners centered in the origin without rotation.
+		 */
+		void calculateCorners()
+		{
+			double half = size / 2.0;
+
+			world[0] = Point3f(-half, -half, 0);
+			world[1] = Point3f(-half, +half, 0);
+			world[2] = Point3f(half, +half, 0);
+			world[3] = Point3f(half, -half, 0);
+		}
+
 		/**
 		 * Print info about this marker to the stdout.
 		 */
@@ -132,7 +135,7 @@ class ArucoMarkerInfo
 			cout << "    Position: " << position.x << ", " << position.y << ", " << position.z << endl;
 			cout << "    Rotation: " << rotation.x << ", " << rotation.y << ", " << rotation.z << endl;
 
-			for(unsigned int i = 0; i < world.size(); i++)
+			for(unsigned int i = 0; i < 4; i++)
 			{
 				cout << "    World: " << world[i].x << ", " << world[i].y << ", " << world[i].z << endl;
 			}
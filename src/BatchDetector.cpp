@@ -0,0 +1,286 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <future>
+
+#include <opencv2/core/core.hpp>
+
+#include "ArucoDetector.cpp"
+#include "StreamDetector.cpp"
+#include "ThreadPool.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Frame given to the batch detector.
+ */
+class BatchFrame
+{
+	public:
+		/**
+		 * Image of the frame (color or grayscale).
+		 */
+		Mat frame;
+
+		/**
+		 * Id of the camera that captured the frame.
+		 */
+		int camera;
+
+		/**
+		 * Capture time of the frame in seconds.
+		 */
+		double timestamp;
+
+		/**
+		 * Batch frame constructor.
+		 * @param _frame Image of the frame.
+		 * @param _camera Id of the camera.
+		 * @param _timestamp Capture time in seconds.
+		 */
+		BatchFrame(Mat _frame = Mat(), int _camera = 0, double _timestamp = 0.0)
+		{
+			frame = _frame;
+			camera = _camera;
+			timestamp = _timestamp;
+		}
+};
+
+/**
+ * Markers found in one frame of a batch.
+ */
+class BatchResult
+{
+	public:
+		/**
+		 * Id of the camera that captured the frame.
+		 */
+		int camera;
+
+		/**
+		 * Capture time of the frame in seconds.
+		 */
+		double timestamp;
+
+		/**
+		 * Markers found in the frame.
+		 */
+		vector<ArucoMarker> markers;
+};
+
+/**
+ * Detects markers in frames from multiple cameras using a single thread pool.
+ *
+ * Each camera has a StreamDetector pipeline created from the settings detector the first time the camera is seen.
+ * The frames of the batch are submitted to the pipeline of their camera, the threshold, quad search and decode stages of consecutive frames of a camera run at the same time in the stage threads and the pipelines of the cameras run in parallel.
+ * The pipelines share the batch pool for the parallel parts of each stage (tiled quad search and candidate decoding). Nothing is dropped, a camera with more frames than the pipeline holds waits for its stages.
+ *
+ * Tracking needs the markers of the previous frame before the next frame is searched, when tracking is enabled in the settings each camera has an ArucoDetector instead and only the cameras run in parallel, the frames of a camera are processed one after the other.
+ */
+class BatchDetector
+{
+	public:
+		/**
+		 * Detector used as template for the camera detectors, changes only affect cameras seen after the change.
+		 * The threads option is ignored, the camera detectors use the batch thread pool.
+		 */
+		ArucoDetector settings;
+
+		/**
+		 * Id of the camera of each detector.
+		 */
+		vector<int> cameras;
+
+		/**
+		 * Detector of each camera, used when tracking is enabled.
+		 */
+		vector<shared_ptr<ArucoDetector>> detectors;
+
+		/**
+		 * Pipeline of each camera, used when tracking is disabled.
+		 */
+		vector<shared_ptr<StreamDetector>> streams;
+
+		/**
+		 * Thread pool shared by all the cameras.
+		 */
+		shared_ptr<ThreadPool> pool;
+
+		/**
+		 * Result of each frame of the last batch, in the same order as the frames.
+		 */
+		vector<BatchResult> results;
+
+		/**
+		 * Batch detector constructor.
+		 * @param threads Number of threads of the pool, if 0 the number of hardware threads is used.
+		 */
+		BatchDetector(unsigned int threads = 0)
+		{
+			pool = make_shared<ThreadPool>(threads);
+		}
+
+		/**
+		 * Get the detector of a camera, created from the settings if the camera was not seen before.
+		 * When tracking is disabled the detector is the settings of the camera pipeline, changes are not used by the pipeline.
+		 * @param camera Id of the camera.
+		 * @return Detector of the camera.
+		 */
+		ArucoDetector &getDetector(int camera)
+		{
+			int index = indexOf(camera);
+			return detectors[index] ? *detectors[index] : streams[index]->settings;
+		}
+
+		/**
+		 * Detect markers in a batch of frames.
+		 * @param frames Frames to process.
+		 * @param count Number of frames.
+		 * @return Result of each frame in the same order as the frames, valid until the next call.
+		 */
+		vector<BatchResult> &detect(const BatchFrame *frames, int count)
+		{
+			results.resize(count);
+
+			if(!settings.tracking)
+			{
+				detectPipelined(frames, count);
+				return results;
+			}
+
+			active.clear();
+
+			//Group the frames by camera, keeping their order
+			for(unsigned int i = 0; i < groups.size(); i++)
+			{
+				groups[i].clear();
+			}
+
+			for(int i = 0; i < count; i++)
+			{
+				int index = indexOf(frames[i].camera);
+
+				if(groups[index].empty())
+				{
+					active.push_back(index);
+				}
+
+				groups[index].push_back(i);
+			}
+
+			pool->parallelFor(active.size(), [this, frames](int task, int worker)
+			{
+				int index = active[task];
+				ArucoDetector &detector = *detectors[index];
+
+				for(unsigned int k = 0; k < groups[index].size(); k++)
+				{
+					int i = groups[index][k];
+
+					BatchResult &result = results[i];
+					result.camera = frames[i].camera;
+					result.timestamp = frames[i].timestamp;
+					result.markers = detector.detect(frames[i].frame);
+				}
+			});
+
+			return results;
+		}
+
+		/**
+		 * Detect markers in a batch of frames.
+		 * @param frames Frames to process.
+		 * @return Result of each frame in the same order as the frames, valid until the next call.
+		 */
+		vector<BatchResult> &detect(const vector<BatchFrame> &frames)
+		{
+			return detect(frames.data(), frames.size());
+		}
+
+	private:
+		/**
+		 * Index of the frames of the batch for each camera detector.
+		 */
+		vector<vector<int>> groups;
+
+		/**
+		 * Camera detectors with frames in the batch.
+		 */
+		vector<int> active;
+
+		/**
+		 * Result of each frame submitted to the pipelines.
+		 */
+		vector<future<StreamResult>> pending;
+
+		/**
+		 * Submit all the frames to the pipelines of their cameras and wait for the results.
+		 * Frames of a camera are submitted in order, the pipelines keep the order of the frames.
+		 * An exception thrown while processing a frame (e.g. a frame in an unsupported pixel format) is rethrown here after all the frames were submitted.
+		 * @param frames Frames to process.
+		 * @param count Number of frames.
+		 */
+		void detectPipelined(const BatchFrame *frames, int count)
+		{
+			pending.resize(count);
+
+			for(int i = 0; i < count; i++)
+			{
+				pending[i] = streams[indexOf(frames[i].camera)]->submit(frames[i].frame);
+			}
+
+			for(int i = 0; i < count; i++)
+			{
+				StreamResult result = pending[i].get();
+
+				results[i].camera = frames[i].camera;
+				results[i].timestamp = frames[i].timestamp;
+				results[i].markers = result.markers;
+			}
+		}
+
+		/**
+		 * Get the index of the detector of a camera, creating it if necessary.
+		 * @param camera Id of the camera.
+		 * @return Index of the detector.
+		 */
+		int indexOf(int camera)
+		{
+			for(unsigned int i = 0; i < cameras.size(); i++)
+			{
+				if(cameras[i] == camera)
+				{
+					return i;
+				}
+			}
+
+			shared_ptr<ArucoDetector> detector = make_shared<ArucoDetector>(settings);
+			detector->setThreadPool(pool);
+
+			shared_ptr<StreamDetector> stream;
+
+			//Frames of a camera are never dropped, the caller waits for all the frames of the batch
+			if(!settings.tracking)
+			{
+				stream = make_shared<StreamDetector>();
+				stream->settings = *detector;
+				detector.reset();
+
+				for(int i = 0; i < StreamDetector::STAGES; i++)
+				{
+					stream->policies[i] = DROP_NONE;
+				}
+
+				stream->start();
+			}
+
+			cameras.push_back(camera);
+			detectors.push_back(detector);
+			streams.push_back(stream);
+			groups.push_back(vector<int>());
+
+			return cameras.size() - 1;
+		}
+};
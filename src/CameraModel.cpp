@@ -0,0 +1,285 @@
+#pragma once
+
+#include <vector>
+#include <math.h>
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Camera intrinsics and lens distortion, used to undistort the detected marker corners.
+ *
+ * The inverse of the distortion has no closed form, so it is evaluated once per calibration on a sparse grid of pixels (lookup table).
+ * Corners are undistorted by bilinear interpolation of the table, only the corners are undistorted (not the image) and the pose solvers work on the normalized coordinates.
+ * Points outside of the table are undistorted iteratively.
+ */
+class CameraModel
+{
+	public:
+		/**
+		 * Distortion models supported.
+		 */
+		enum Model
+		{
+			/**
+			 * Pinhole with radial and tangential distortion (k1, k2, p1, p2, k3, k4, k5, k6), same as OpenCV calibrateCamera and ROS plumb_bob and rational_polynomial.
+			 */
+			MODEL_PINHOLE = 0,
+
+			/**
+			 * Equidistant fisheye (k1, k2, k3, k4), same as OpenCV fisheye and ROS equidistant.
+			 */
+			MODEL_FISHEYE = 1
+		};
+
+		/**
+		 * Distortion model of the lens.
+		 */
+		Model model;
+
+		/**
+		 * Focal length in pixels.
+		 */
+		double fx, fy;
+
+		/**
+		 * Principal point in pixels.
+		 */
+		double cx, cy;
+
+		/**
+		 * Distortion coefficients, missing coefficients are zero.
+		 */
+		double k[8];
+
+		/**
+		 * Spacing of the lookup table samples in pixels.
+		 */
+		int step;
+
+		/**
+		 * Number of columns and rows of the lookup table.
+		 */
+		int cols, rows;
+
+		/**
+		 * Normalized undistorted coordinates of each lookup table sample (stored by rows).
+		 */
+		vector<float> tableX, tableY;
+
+		/**
+		 * Camera model constructor, without distortion.
+		 * @param _step Spacing of the lookup table samples in pixels.
+		 */
+		CameraModel(int _step = 4)
+		{
+			model = MODEL_PINHOLE;
+			fx = fy = 1.0;
+			cx = cy = 0.0;
+			step = _step;
+			cols = rows = 0;
+
+			for(int i = 0; i < 8; i++)
+			{
+				k[i] = 0.0;
+			}
+		}
+
+		/**
+		 * Set the calibration of the camera, the lookup table has to be built after.
+		 * @param camera Camera intrinsic calibration matrix.
+		 * @param distortion Distortion coefficients (any number, the ones not used by the model are ignored).
+		 * @param _model Distortion model.
+		 */
+		void set(Mat camera, const vector<double> &distortion, Model _model)
+		{
+			Mat intrinsic;
+			camera.convertTo(intrinsic, CV_64F);
+
+			fx = intrinsic.at<double>(0, 0);
+			fy = intrinsic.at<double>(1, 1);
+			cx = intrinsic.at<double>(0, 2);
+			cy = intrinsic.at<double>(1, 2);
+			model = _model;
+
+			int count = model == MODEL_FISHEYE ? 4 : 8;
+
+			for(int i = 0; i < 8; i++)
+			{
+				k[i] = i < count && i < (int)distortion.size() ? distortion[i] : 0.0;
+			}
+
+			cols = rows = 0;
+		}
+
+		/**
+		 * Build the undistortion lookup table.
+		 * @param size Size of the image, if empty it is estimated from the principal point.
+		 */
+		void build(Size size = Size())
+		{
+			if(size.width <= 0 || size.height <= 0)
+			{
+				size = Size((int)(cx * 2.0) + 1, (int)(cy * 2.0) + 1);
+			}
+
+			//One extra sample on each side so that corners in the border still have 4 neighbors
+			cols = size.width / step + 2;
+			rows = size.height / step + 2;
+
+			tableX.resize(cols * rows);
+			tableY.resize(cols * rows);
+
+			for(int r = 0; r < rows; r++)
+			{
+				for(int c = 0; c < cols; c++)
+				{
+					double x, y;
+					undistortPoint((c * step - cx) / fx, (r * step - cy) / fy, x, y);
+
+					tableX[r * cols + c] = x;
+					tableY[r * cols + c] = y;
+				}
+			}
+		}
+
+		/**
+		 * Check if the lookup table was built.
+		 */
+		bool ready() const
+		{
+			return cols > 0;
+		}
+
+		/**
+		 * Undistort points to normalized camera coordinates.
+		 * @param points Points in pixels.
+		 * @param count Number of points.
+		 * @param x Normalized x coordinate of each point.
+		 * @param y Normalized y coordinate of each point.
+		 */
+		void undistort(const Point2f *points, int count, double *x, double *y) const
+		{
+			for(int i = 0; i < count; i++)
+			{
+				float u = points[i].x / step;
+				float v = points[i].y / step;
+
+				int c = (int)floor(u);
+				int r = (int)floor(v);
+
+				//Outside of the table
+				if(c < 0 || r < 0 || c >= cols - 1 || r >= rows - 1)
+				{
+					undistortPoint((points[i].x - cx) / fx, (points[i].y - cy) / fy, x[i], y[i]);
+					continue;
+				}
+
+				float a = u - c;
+				float b = v - r;
+				int index = r * cols + c;
+
+				const float *px = &tableX[index];
+				const float *py = &tableY[index];
+
+				x[i] = (px[0] * (1.0f - a) + px[1] * a) * (1.0f - b) + (px[cols] * (1.0f - a) + px[cols + 1] * a) * b;
+				y[i] = (py[0] * (1.0f - a) + py[1] * a) * (1.0f - b) + (py[cols] * (1.0f - a) + py[cols + 1] * a) * b;
+			}
+		}
+
+		/**
+		 * Apply the distortion to a normalized point.
+		 * @param x Undistorted normalized x coordinate.
+		 * @param y Undistorted normalized y coordinate.
+		 * @param dx Distorted normalized x coordinate.
+		 * @param dy Distorted normalized y coordinate.
+		 */
+		void distortPoint(double x, double y, double &dx, double &dy) const
+		{
+			if(model == MODEL_FISHEYE)
+			{
+				double r = sqrt(x * x + y * y);
+				if(r < 1e-12)
+				{
+					dx = x;
+					dy = y;
+					return;
+				}
+
+				double theta = atan(r);
+				double t2 = theta * theta;
+				double distorted = theta * (1.0 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3]))));
+
+				dx = x * distorted / r;
+				dy = y * distorted / r;
+				return;
+			}
+
+			double r2 = x * x + y * y;
+			double radial = (1.0 + r2 * (k[0] + r2 * (k[1] + r2 * k[4]))) / (1.0 + r2 * (k[5] + r2 * (k[6] + r2 * k[7])));
+
+			dx = x * radial + 2.0 * k[2] * x * y + k[3] * (r2 + 2.0 * x * x);
+			dy = y * radial + k[2] * (r2 + 2.0 * y * y) + 2.0 * k[3] * x * y;
+		}
+
+		/**
+		 * Remove the distortion of a normalized point (iterative).
+		 * @param dx Distorted normalized x coordinate.
+		 * @param dy Distorted normalized y coordinate.
+		 * @param x Undistorted normalized x coordinate.
+		 * @param y Undistorted normalized y coordinate.
+		 */
+		void undistortPoint(double dx, double dy, double &x, double &y) const
+		{
+			if(model == MODEL_FISHEYE)
+			{
+				//Solve the distorted angle polynomial for the incidence angle (Newton)
+				double distorted = sqrt(dx * dx + dy * dy);
+				if(distorted < 1e-12)
+				{
+					x = dx;
+					y = dy;
+					return;
+				}
+
+				double theta = distorted;
+
+				for(int i = 0; i < 20; i++)
+				{
+					double t2 = theta * theta;
+					double f = theta * (1.0 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3])))) - distorted;
+					double df = 1.0 + t2 * (3.0 * k[0] + t2 * (5.0 * k[1] + t2 * (7.0 * k[2] + t2 * 9.0 * k[3])));
+					double delta = f / df;
+
+					theta = min(max(theta - delta, 0.0), M_PI / 2.0 - 1e-6);
+
+					if(fabs(delta) < 1e-14)
+					{
+						break;
+					}
+				}
+
+				double scale = tan(theta) / distorted;
+				x = dx * scale;
+				y = dy * scale;
+				return;
+			}
+
+			//Fixed point iteration, converges for the distortion of usual lenses
+			x = dx;
+			y = dy;
+
+			for(int i = 0; i < 20; i++)
+			{
+				double r2 = x * x + y * y;
+				double radial = (1.0 + r2 * (k[5] + r2 * (k[6] + r2 * k[7]))) / (1.0 + r2 * (k[0] + r2 * (k[1] + r2 * k[4])));
+				double tx = 2.0 * k[2] * x * y + k[3] * (r2 + 2.0 * x * x);
+				double ty = k[2] * (r2 + 2.0 * y * y) + 2.0 * k[3] * x * y;
+
+				x = (dx - tx) * radial;
+				y = (dy - ty) * radial;
+			}
+		}
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+
+#include "math/Homography.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Reads the cells of a marker candidate directly from the grayscale image.
+ * The homography from the marker square to the quad is calculated in closed form and only a small pattern of points per cell is sampled.
+ * Replaces the perspective warp, resize, color conversion and Otsu threshold used to read the cells from a full corrected image.
+ */
+class CellSampler
+{
+	public:
+		/**
+		 * Maximum number of cells per side supported (including the border).
+		 */
+		static const int MAX_CELLS = 10;
+
+		/**
+		 * Read the cells of a candidate.
+		 * Cells are classified using the border cells as black reference and the brightest inner cell as white reference.
+		 * Cells are stored by rows, the first row is the one between quad points 0 and 3 and the first column the one between quad points 0 and 1 (same layout as the image obtained with ArucoDetector::deformQuad).
+		 * The number of cells is a template parameter so that the loops are fully unrolled for each marker family.
+		 * @param gray Grayscale image.
+		 * @param quad Quad points of the candidate.
+		 * @param out Output array with CELLS * CELLS values, 1 for white cells and 0 for black cells.
+		 * @param minContrast Minimum difference between the black and white reference.
+		 * @return False if the candidate does not have enough contrast to be a marker.
+		 */
+		template<int CELLS> static bool read(const Mat &gray, const Point2f quad[4], int *out, float minContrast = 20.0f)
+		{
+			static_assert(CELLS > 2 && CELLS <= MAX_CELLS, "Unsupported number of cells");
+			CV_Assert(gray.type() == CV_8UC1);
+
+			Homography homography = Homography::squareToQuad(quad);
+
+			float values[CELLS * CELLS];
+			const double step = 1.0 / CELLS;
+
+			float black = 0.0f;
+			float white = 0.0f;
+
+			for(int i = 0; i < CELLS; i++)
+			{
+				for(int j = 0; j < CELLS; j++)
+				{
+					float value = sampleCell(gray, homography, (i + 0.5) * step, (j + 0.5) * step, step * 0.25);
+					values[i * CELLS + j] = value;
+
+					if(i == 0 || j == 0 || i == CELLS - 1 || j == CELLS - 1)
+					{
+						black += value;
+					}
+					else if(value > white)
+					{
+						white = value;
+					}
+				}
+			}
+
+			black /= 4 * (CELLS - 1);
+
+			if(white - black < minContrast)
+			{
+				return false;
+			}
+
+			float threshold = (black + white) * 0.5f;
+
+			for(int i = 0; i < CELLS * CELLS; i++)
+			{
+				out[i] = values[i] > threshold ? 1 : 0;
+			}
+
+			return true;
+		}
+
+		/**
+		 * Read the cells of a candidate with the number of cells known only at runtime.
+		 * @param gray Grayscale image.
+		 * @param quad Quad points of the candidate.
+		 * @param cells Number of cells per side including the border.
+		 * @param out Output array with cells * cells values, 1 for white cells and 0 for black cells.
+		 * @param minContrast Minimum difference between the black and white reference.
+		 * @return False if the candidate does not have enough contrast to be a marker.
+		 */
+		static bool read(const Mat &gray, const Point2f quad[4], int cells, int *out, float minContrast = 20.0f)
+		{
+			CV_Assert(cells > 2 && cells <= MAX_CELLS);
+
+			switch(cells)
+			{
+				case 3: return read<3>(gray, quad, out, minContrast);
+				case 4: return read<4>(gray, quad, out, minContrast);
+				case 5: return read<5>(gray, quad, out, minContrast);
+				case 6: return read<6>(gray, quad, out, minContrast);
+				case 7: return read<7>(gray, quad, out, minContrast);
+				case 8: return read<8>(gray, quad, out, minContrast);
+				case 9: return read<9>(gray, quad, out, minContrast);
+			}
+
+			return read<10>(gray, quad, out, minContrast);
+		}
+
+		/**
+		 * Sample a cell using its center and four points around it.
+		 * @param gray Grayscale image.
+		 * @param homography Homography from the unit square to the quad.
+		 * @param u Cell center coordinate (towards quad point 1).
+		 * @param v Cell center coordinate (towards quad point 3).
+		 * @param offset Offset of the extra points from the center in the unit square.
+		 * @return Mean intensity of the samples.
+		 */
+		static inline float sampleCell(const Mat &gray, const Homography &homography, double u, double v, double offset)
+		{
+			float sum = bilinear(gray, homography.apply(u, v));
+			sum += bilinear(gray, homography.apply(u - offset, v - offset));
+			sum += bilinear(gray, homography.apply(u - offset, v + offset));
+			sum += bilinear(gray, homography.apply(u + offset, v - offset));
+			sum += bilinear(gray, homography.apply(u + offset, v + offset));
+
+			return sum * 0.2f;
+		}
+
+		/**
+		 * Bilinear interpolation of a grayscale image, coordinates outside of the image are clamped.
+		 * @param gray Grayscale image.
+		 * @param p Point in image coordinates.
+		 * @return Interpolated intensity.
+		 */
+		static inline float bilinear(const Mat &gray, Point2d p)
+		{
+			float x = (float)min(max(p.x, 0.0), gray.cols - 1.001);
+			float y = (float)min(max(p.y, 0.0), gray.rows - 1.001);
+
+			int x0 = (int)x;
+			int y0 = (int)y;
+			float fx = x - x0;
+			float fy = y - y0;
+
+			const uchar *row0 = gray.ptr<uchar>(y0) + x0;
+			const uchar *row1 = gray.ptr<uchar>(y0 + 1) + x0;
+
+			float top = row0[0] + (row0[1] - row0[0]) * fx;
+			float bottom = row1[0] + (row1[1] - row1[0]) * fx;
+
+			return top + (bottom - top) * fy;
+		}
+};
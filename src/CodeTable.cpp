@@ -0,0 +1,271 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+using namespace std;
+
+/**
+ * Lookup table that maps NxN marker payloads to code words.
+ * Every payload within a hamming radius of a code word (in any of the four rotations) is stored in a open addressing hash table with its id, rotation and distance.
+ * Decoding a payload is a single probe, independently of the radius used for error correction.
+ *
+ * Payloads store the cell [i][j] in the bit i * N + j.
+ * Payloads equally close to more than one code word (or to one code word in different rotations) are marked as ambiguous and rejected.
+ * On exact matches the lowest rotation is kept, as a search trying the rotations in order would do.
+ *
+ * Each slot uses 8 bytes, the payload is stored above a 15 bit value (10 bits id, 2 bits rotation, 2 bits distance, ambiguous flag).
+ */
+template<int N> class CodeTable
+{
+	public:
+		/**
+		 * Maximum radius supported.
+		 */
+		static const int MAX_RADIUS = 2;
+
+		/**
+		 * Maximum number of code words supported.
+		 */
+		static const int MAX_CODES = 1024;
+
+		/**
+		 * Hamming radius used to build the table.
+		 */
+		int radius;
+
+		/**
+		 * Build the lookup table.
+		 * @param codes Code words, the index of each code is its id (between 1 and MAX_CODES code words).
+		 * @param _radius Maximum number of wrong bits corrected.
+		 */
+		CodeTable(const vector<uint64_t> &codes, int _radius = 0)
+		{
+			static_assert(N >= 3 && N <= 6, "Payloads from 3x3 to 6x6 cells are supported");
+			CV_Assert(!codes.empty() && codes.size() <= (size_t)MAX_CODES);
+
+			radius = min(max(_radius, 0), (int)MAX_RADIUS);
+
+			//Number of payloads within the radius of each code word
+			size_t neighbours = 1;
+			if(radius >= 1) neighbours += BITS;
+			if(radius >= 2) neighbours += BITS * (BITS - 1) / 2;
+
+			size_t count = codes.size();
+			size_t capacity = 1;
+			shift = 64;
+			while(capacity < neighbours * count * 4 * 3 / 2)
+			{
+				capacity <<= 1;
+				shift--;
+			}
+
+			mask = capacity - 1;
+			table.assign(capacity, (uint64_t)EMPTY);
+
+			for(size_t id = 0; id < count; id++)
+			{
+				for(int rotation = 0; rotation < 4; rotation++)
+				{
+					//Payload read from a marker that has to be rotated this number of times to match the code word
+					uint64_t read = codes[id];
+					for(int k = 0; k < (4 - rotation) % 4; k++)
+					{
+						read = rotate(read);
+					}
+
+					insertNeighbours(read, (int)id, rotation, 0, 0);
+				}
+			}
+		}
+
+		/**
+		 * Decode a payload.
+		 * @param payload Payload with the NxN cells.
+		 * @param id Id of the code word.
+		 * @param rotation Number of 90 degree rotations needed to get the payload in the code word orientation.
+		 * @param distance Number of bits corrected.
+		 * @return True if the payload was decoded.
+		 */
+		bool decode(uint64_t payload, int &id, int &rotation, int &distance) const
+		{
+			size_t slot = hash(payload);
+
+			while(table[slot] != EMPTY)
+			{
+				if((table[slot] >> VALUE_BITS) == payload)
+				{
+					uint32_t value = (uint32_t)(table[slot] & VALUE_MASK);
+
+					if(value & AMBIGUOUS)
+					{
+						return false;
+					}
+
+					id = value & 1023;
+					rotation = (value >> 10) & 3;
+					distance = (value >> 12) & 3;
+					return true;
+				}
+
+				slot = (slot + 1) & mask;
+			}
+
+			return false;
+		}
+
+		/**
+		 * Number of slots used in the table.
+		 * @return Number of payloads stored.
+		 */
+		size_t entries() const
+		{
+			size_t count = 0;
+
+			for(size_t i = 0; i < table.size(); i++)
+			{
+				if(table[i] != EMPTY)
+				{
+					count++;
+				}
+			}
+
+			return count;
+		}
+
+		/**
+		 * Memory used by the table in bytes.
+		 * @return Size of the table.
+		 */
+		size_t memory() const
+		{
+			return table.size() * sizeof(uint64_t);
+		}
+
+		/**
+		 * Rotate payload 90 degrees, cell [i][j] receives the cell [N - 1 - j][i].
+		 * @param value Payload to rotate.
+		 * @return Rotated payload.
+		 */
+		static uint64_t rotate(uint64_t value)
+		{
+			uint64_t out = 0;
+
+			for(int i = 0; i < N; i++)
+			{
+				for(int j = 0; j < N; j++)
+				{
+					out |= ((value >> ((N - 1 - j) * N + i)) & 1) << (i * N + j);
+				}
+			}
+
+			return out;
+		}
+
+	private:
+		/**
+		 * Number of bits in the payload.
+		 */
+		static const int BITS = N * N;
+
+		/**
+		 * Number of bits used by the value in each slot.
+		 */
+		static const int VALUE_BITS = 15;
+
+		/**
+		 * Mask of the value in each slot.
+		 */
+		static const uint64_t VALUE_MASK = (1 << VALUE_BITS) - 1;
+
+		/**
+		 * Value of the empty slots, can't be a valid payload since the payload has at most 36 bits.
+		 */
+		static const uint64_t EMPTY = ~(uint64_t)0;
+
+		/**
+		 * Flag set in the value of ambiguous payloads.
+		 */
+		static const uint32_t AMBIGUOUS = 1 << 14;
+
+		/**
+		 * Hash table slots.
+		 */
+		vector<uint64_t> table;
+
+		/**
+		 * Mask used to wrap slot indexes, the capacity is a power of two.
+		 */
+		size_t mask;
+
+		/**
+		 * Shift used by the hash to keep the bits needed to index the table.
+		 */
+		int shift;
+
+		/**
+		 * Slot index for a payload (fibonacci hashing).
+		 */
+		inline size_t hash(uint64_t payload) const
+		{
+			return (size_t)((payload * 0x9E3779B97F4A7C15ULL) >> shift) & mask;
+		}
+
+		/**
+		 * Insert payload and all the payloads obtained by flipping more bits (above the last flipped) until the radius.
+		 * @param payload Payload to insert.
+		 * @param id Code word id.
+		 * @param rotation Rotation of the payload.
+		 * @param distance Number of bits flipped.
+		 * @param first First bit that can be flipped.
+		 */
+		void insertNeighbours(uint64_t payload, int id, int rotation, int distance, int first)
+		{
+			insert(payload, id, rotation, distance);
+
+			if(distance < radius)
+			{
+				for(int b = first; b < BITS; b++)
+				{
+					insertNeighbours(payload ^ ((uint64_t)1 << b), id, rotation, distance + 1, b + 1);
+				}
+			}
+		}
+
+		/**
+		 * Insert payload in the table.
+		 * Closer code words replace farther ones, on exact matches the lowest rotation is kept and other ties are marked ambiguous.
+		 */
+		void insert(uint64_t payload, int id, int rotation, int distance)
+		{
+			uint32_t value = (uint32_t)(id | (rotation << 10) | (distance << 12));
+			size_t slot = hash(payload);
+
+			while(table[slot] != EMPTY)
+			{
+				if((table[slot] >> VALUE_BITS) == payload)
+				{
+					uint32_t old = (uint32_t)(table[slot] & VALUE_MASK);
+					int oldRotation = (old >> 10) & 3;
+					int oldDistance = (old >> 12) & 3;
+
+					if(distance < oldDistance || (distance == 0 && oldDistance == 0 && rotation < oldRotation))
+					{
+						table[slot] = (payload << VALUE_BITS) | value;
+					}
+					else if(distance == oldDistance && distance > 0 && (old & (AMBIGUOUS - 1)) != value)
+					{
+						table[slot] |= AMBIGUOUS;
+					}
+
+					return;
+				}
+
+				slot = (slot + 1) & mask;
+			}
+
+			table[slot] = (payload << VALUE_BITS) | value;
+		}
+};
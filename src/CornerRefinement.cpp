@@ -1,11 +1,231 @@
 #pragma once
 
+#include <vector>
+#include <math.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Buffers used to refine the corners of a batch of quads.
+ * Sample coordinates and values are stored as flat arrays (one entry per profile sample of all quads) so that they are processed in tight loops.
+ */
+class EdgeSamples
+{
+	public:
+		/**
+		 * X coordinate of each sample.
+		 */
+		vector<float> x;
+
+		/**
+		 * Y coordinate of each sample.
+		 */
+		vector<float> y;
+
+		/**
+		 * Intensity of each sample.
+		 */
+		vector<float> value;
+
+		/**
+		 * Edge points found, for each profile.
+		 */
+		vector<Point2f> points;
+
+		/**
+		 * Weight of the edge points found, 0 when the profile has no edge.
+		 */
+		vector<float> weights;
+};
+
 /**
  * This class contains methods to perform corner refinement on the points found by the SquareFinder.
  */
 class CornerRefinement
-{	
+{
 	public:
+		/**
+		 * Refine the corners of a batch of quads by fitting lines to their edges with subpixel precision.
+		 * For each edge a set of profiles normal to the edge is sampled (bilinear interpolation), the edge position in each profile is the maximum of the dark to bright derivative (going out of the quad) refined with a parabola.
+		 * A line is fitted to the edge points of each edge (weighted total least squares) and the corners are the intersections of adjacent lines.
+		 * Using only dark to bright transitions avoids the edges between the border and the inner white cells.
+		 * The samples of all the quads are gathered and interpolated together, quads that don't have enough edge points keep their corners.
+		 * @param gray Grayscale image.
+		 * @param corners Corners of the quads, 4 consecutive points per quad, refined in place.
+		 * @param count Number of quads.
+		 * @param samples Buffers used for the refinement.
+		 * @param profiles Number of profiles per edge.
+		 * @param range Distance searched on each side of the edge in pixels.
+		 * @return Number of quads refined.
+		 */
+		static int refineEdges(const Mat &gray, Point2f *corners, int count, EdgeSamples &samples, int profiles = 12, float range = 2.5f)
+		{
+			CV_Assert(gray.type() == CV_8UC1 && profiles >= 3);
+
+			const float step = 0.5f;
+			const int length = (int)(2.0f * range / step) + 1;
+			const int total = count * 4 * profiles;
+
+			samples.x.resize(total * length);
+			samples.y.resize(total * length);
+			samples.value.resize(total * length);
+			samples.points.resize(total);
+			samples.weights.resize(total);
+
+			//Sample positions, profiles start inside the quad and go out
+			float *px = samples.x.data();
+			float *py = samples.y.data();
+
+			for(int q = 0; q < count; q++)
+			{
+				const Point2f *quad = corners + q * 4;
+				Point2f center = (quad[0] + quad[1] + quad[2] + quad[3]) * 0.25f;
+
+				for(int e = 0; e < 4; e++)
+				{
+					Point2f a = quad[e];
+					Point2f b = quad[(e + 1) % 4];
+					Point2f direction = b - a;
+					float size = sqrt(direction.x * direction.x + direction.y * direction.y) + 1e-6f;
+					Point2f normal(-direction.y / size, direction.x / size);
+
+					if(normal.dot(a - center) < 0.0f)
+					{
+						normal = Point2f(-normal.x, -normal.y);
+					}
+
+					for(int p = 0; p < profiles; p++)
+					{
+						//Profiles in the middle 70% of the edge, away from the corners
+						Point2f base = a + direction * (0.15f + 0.7f * (p + 0.5f) / profiles);
+
+						for(int k = 0; k < length; k++)
+						{
+							float offset = -range + k * step;
+							*px++ = base.x + normal.x * offset;
+							*py++ = base.y + normal.y * offset;
+						}
+					}
+				}
+			}
+
+			interpolate(gray, samples.x.data(), samples.y.data(), samples.value.data(), total * length);
+
+			//Edge position in each profile
+			for(int i = 0; i < total; i++)
+			{
+				const float *v = samples.value.data() + i * length;
+				int best = -1;
+				float strongest = 0.0f;
+
+				for(int k = 1; k < length - 1; k++)
+				{
+					float derivative = v[k + 1] - v[k - 1];
+					if(derivative > strongest)
+					{
+						strongest = derivative;
+						best = k;
+					}
+				}
+
+				samples.weights[i] = 0.0f;
+
+				if(best > 1 && best < length - 2 && strongest > MIN_DERIVATIVE)
+				{
+					float before = v[best] - v[best - 2];
+					float after = v[best + 2] - v[best];
+					float den = before - 2.0f * strongest + after;
+					float delta = fabs(den) > 1e-6f ? 0.5f * (before - after) / den : 0.0f;
+					delta = min(max(delta, -0.5f), 0.5f);
+
+					//Interpolate between the first and last sample position of the profile
+					float t = (best + delta) / (length - 1);
+					int first = i * length;
+					int last = first + length - 1;
+
+					samples.points[i] = Point2f(samples.x[first] + (samples.x[last] - samples.x[first]) * t, samples.y[first] + (samples.y[last] - samples.y[first]) * t);
+					samples.weights[i] = strongest;
+				}
+			}
+
+			//Fit edge lines and intersect them
+			int refined = 0;
+
+			for(int q = 0; q < count; q++)
+			{
+				Point2f *quad = corners + q * 4;
+				Point3f lines[4];
+				bool valid = true;
+
+				for(int e = 0; e < 4 && valid; e++)
+				{
+					int first = (q * 4 + e) * profiles;
+					valid = fitLine(samples.points.data() + first, samples.weights.data() + first, profiles, lines[e]);
+				}
+
+				Point2f result[4];
+				for(int c = 0; c < 4 && valid; c++)
+				{
+					//Corner c is between the edge c - 1 and the edge c
+					valid = intersect(lines[(c + 3) % 4], lines[c], result[c]);
+
+					Point2f shift = result[c] - quad[c];
+					valid = valid && shift.dot(shift) < 4.0f * range * range;
+				}
+
+				if(valid)
+				{
+					for(int c = 0; c < 4; c++)
+					{
+						quad[c] = result[c];
+					}
+
+					refined++;
+				}
+			}
+
+			return refined;
+		}
+
+		/**
+		 * Bilinear interpolation of a list of points of a grayscale image, coordinates outside of the image are clamped.
+		 * @param gray Grayscale image.
+		 * @param x X coordinates.
+		 * @param y Y coordinates.
+		 * @param out Interpolated values.
+		 * @param count Number of points.
+		 */
+		static void interpolate(const Mat &gray, const float *x, const float *y, float *out, int count)
+		{
+			const uchar *data = gray.data;
+			size_t stride = gray.step;
+			float maxX = gray.cols - 1.001f;
+			float maxY = gray.rows - 1.001f;
+
+			for(int i = 0; i < count; i++)
+			{
+				float sx = min(max(x[i], 0.0f), maxX);
+				float sy = min(max(y[i], 0.0f), maxY);
+
+				int x0 = (int)sx;
+				int y0 = (int)sy;
+				float fx = sx - x0;
+				float fy = sy - y0;
+
+				const uchar *row0 = data + y0 * stride + x0;
+				const uchar *row1 = row0 + stride;
+
+				float top = row0[0] + (row0[1] - row0[0]) * fx;
+				float bottom = row1[0] + (row1[1] - row1[0]) * fx;
+				out[i] = top + (bottom - top) * fy;
+			}
+		}
+
 		/**
 		 * Refine corner position using a grayscale version of the captured image (without threshold).
 		 * This method uses the sobel operator and assumes that only one corner is visible, if the box size is too large corners from the marker migth be visible.
@@ -24,13 +244,15 @@ class CornerRefinement
 			int cols = sobel.cols;
 
 			int x = 0, y = 0;
-			int max = sobel.data[0];
+			int max = sobel.at<uchar>(0, 0);
 
 			for(int i = 0; i < rows; i++)
 			{
+				const uchar *row = sobel.ptr<uchar>(i);
+
 				for(int j = 0; j < cols; j++)
 				{
-					int value = sobel.data[rows * i + j];
+					int value = row[j];
 					if(value > max)
 					{
 						x = j;
@@ -40,61 +262,71 @@ class CornerRefinement
 				}
 			}
 
-			#if DEBUG == true
-				Mat debug = gray(roi).clone();
-				debug.at<Vec3b>(x, y) = Vec3b(0, 255, 0);
-				debug.at<Vec3b>(roi.width / 2, roi.height / 2) = Vec3b(0, 0, 255);
+			#if DEBUG
+				Mat debug;
+				cvtColor(gray(roi), debug, COLOR_GRAY2BGR);
+				debug.at<Vec3b>(y, x) = Vec3b(0, 255, 0);
+				debug.at<Vec3b>(corner.y - roi.y, corner.x - roi.x) = Vec3b(0, 0, 255);
 				imshow("Corner", debug);
 			#endif
 
-			return Point2f(corner.x + x - box / 2 , corner.y + y - box / 2);
+			return Point2f(roi.x + x, roi.y + y);
 		}
 
 		/**
 		 * Corner refiment using harris operator.
 		 * @param corner Initial corner position in the image.
-		 * @param gray Grayscale image.
+		 * @param frame Color or grayscale image.
 		 * @param box Box size to refine corner.
 		 */
 		static Point2f refineCornerHarris(Mat frame, Point corner, int box = 10)
 		{
 			Rect roi = getROI(frame, corner, box);
 			Mat dst;
-			
+
 			int thresh = 150;
 
-			Mat area = frame(roi).clone();
 			Mat gray;
-			cvtColor(area, gray, COLOR_BGR2GRAY);
+			if(frame.channels() == 1)
+			{
+				gray = frame(roi);
+			}
+			else
+			{
+				cvtColor(frame(roi), gray, COLOR_BGR2GRAY);
+			}
 
 			cornerHarris(gray, dst, 2, 3, 0.02);
 			normalize(dst, dst, 0, 255, NORM_MINMAX);
 
-			int x = corner.x, y = corner.y;
-			int min = box;
+			int x = corner.x - roi.x, y = corner.y - roi.y;
+			float min = box;
 
 			for(int j = 0; j < dst.rows ; j++)
 			{
 				for(int i = 0; i < dst.cols; i++)
 				{
-					if(dst.at<float>(j,i) > thresh)
+					if(dst.at<float>(j, i) > thresh)
 					{
-						int distance = sqrt(pow(j - box / 2, 2) + pow(i - box / 2, 2));
+						float distance = sqrt(pow(i - (corner.x - roi.x), 2) + pow(j - (corner.y - roi.y), 2));
 						if(distance < min)
 						{
-							x = j;
-							y = i;
+							x = i;
+							y = j;
+							min = distance;
 						}
-						
-						area.at<Vec3b>(j, i) = Vec3b(0, 255, 0);
 					}
 				}
 			}
 
-			area.at<Vec3b>(box / 2, box / 2) = Vec3b(0, 0, 255);
-			imshow("Harris", area);
+			#if DEBUG
+				Mat area;
+				cvtColor(gray, area, COLOR_GRAY2BGR);
+				area.at<Vec3b>(y, x) = Vec3b(0, 255, 0);
+				imshow("Harris", area);
+			#endif
 
-			return Point2f(corner.x + x - box / 2 , corner.y + y - box / 2);
+			return Point2f(roi.x + x, roi.y + y);
 		}
 
 		/**
@@ -106,7 +338,7 @@ class CornerRefinement
 		static Rect getROI(Mat image, Point center, int box)
 		{
 			Rect roi = Rect(center.x - box / 2, center.y - box / 2, box, box);
-			
+
 			if(roi.x < 0) roi.x = 0;
 			if(roi.y < 0) roi.y = 0;
 			if(roi.x + box > image.cols) roi.x = image.cols - box;
@@ -114,4 +346,86 @@ class CornerRefinement
 
 			return roi;
 		}
+
+	private:
+		/**
+		 * Minimum derivative (difference of intensity over 1 pixel) accepted as an edge.
+		 */
+		static const int MIN_DERIVATIVE = 10;
+
+		/**
+		 * Fit a line to weighted points (total least squares).
+		 * @param points Points.
+		 * @param weights Weight of each point, points with zero weight are ignored.
+		 * @param count Number of points.
+		 * @param line Output line (a, b, c) with a * x + b * y + c = 0 and (a, b) normalized.
+		 * @return False if there are less than 3 points.
+		 */
+		static bool fitLine(const Point2f *points, const float *weights, int count, Point3f &line)
+		{
+			float sum = 0.0f, mx = 0.0f, my = 0.0f;
+			int used = 0;
+
+			for(int i = 0; i < count; i++)
+			{
+				if(weights[i] > 0.0f)
+				{
+					sum += weights[i];
+					mx += weights[i] * points[i].x;
+					my += weights[i] * points[i].y;
+					used++;
+				}
+			}
+
+			if(used < 3)
+			{
+				return false;
+			}
+
+			mx /= sum;
+			my /= sum;
+
+			float xx = 0.0f, xy = 0.0f, yy = 0.0f;
+
+			for(int i = 0; i < count; i++)
+			{
+				if(weights[i] > 0.0f)
+				{
+					float dx = points[i].x - mx;
+					float dy = points[i].y - my;
+					xx += weights[i] * dx * dx;
+					xy += weights[i] * dx * dy;
+					yy += weights[i] * dy * dy;
+				}
+			}
+
+			//Line direction is the eigenvector of the largest eigenvalue of the covariance
+			float angle = 0.5f * atan2(2.0f * xy, xx - yy);
+			float a = -sin(angle);
+			float b = cos(angle);
+
+			line = Point3f(a, b, -(a * mx + b * my));
+			return true;
+		}
+
+		/**
+		 * Intersect two lines.
+		 * @param l0 Line 0.
+		 * @param l1 Line 1.
+		 * @param point Output intersection point.
+		 * @return False if the lines are almost parallel.
+		 */
+		static bool intersect(const Point3f &l0, const Point3f &l1, Point2f &point)
+		{
+			float det = l0.x * l1.y - l0.y * l1.x;
+
+			if(fabs(det) < 1e-3f)
+			{
+				return false;
+			}
+
+			point.x = (l0.y * l1.z - l0.z * l1.y) / det;
+			point.y = (l0.z * l1.x - l0.x * l1.z) / det;
+			return true;
+		}
 };
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "math/Quadrilateral.cpp"
+#include "SquareFinder.cpp"
+#include "ArucoMarker.cpp"
+#include "CornerRefinement.cpp"
+#include "QuadGrid.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Buffers used by one thread to decode candidate quads.
+ */
+class DecoderWorkspace
+{
+	public:
+		/**
+		 * Perspective corrected image of a candidate quad.
+		 */
+		Mat board;
+
+		/**
+		 * Candidate image resized to the marker cells size.
+		 */
+		Mat cells;
+
+		/**
+		 * Binary cells of the candidate.
+		 */
+		Mat binary;
+};
+
+/**
+ * Time spent in each stage of the detector for the last frame, in seconds.
+ * Measured with the steady (monotonic) clock a few times per frame, cheap enough to be always enabled.
+ */
+class FrameTimings
+{
+	public:
+		/**
+		 * Grayscale conversion, 0 when the conversion is done in the same pass as the threshold (included in the threshold time) or the frame is already grayscale.
+		 */
+		double convert;
+
+		/**
+		 * Adaptive threshold (and decimation).
+		 */
+		double threshold;
+
+		/**
+		 * Contour search in the binary images.
+		 */
+		double contours;
+
+		/**
+		 * Quad filtering of the contours, merge of the quads found with several block sizes and corner refinement of decimated quads.
+		 */
+		double quads;
+
+		/**
+		 * Decoding of the candidates.
+		 */
+		double decode;
+
+		/**
+		 * Frame timings constructor.
+		 */
+		FrameTimings()
+		{
+			reset();
+		}
+
+		/**
+		 * Set all the times to zero.
+		 */
+		void reset()
+		{
+			convert = 0.0;
+			threshold = 0.0;
+			contours = 0.0;
+			quads = 0.0;
+			decode = 0.0;
+		}
+
+		/**
+		 * Total time of the frame.
+		 * @return Time in seconds.
+		 */
+		double total() const
+		{
+			return convert + threshold + contours + quads + decode;
+		}
+};
+
+/**
+ * Workspace used by the ArucoDetector to process frames.
+ * Owns all the scratch buffers used by the detection pipeline, buffers only grow (to a high water mark) and are reused across frames.
+ * When frames keep the same size the buffers of the context stop moving after the first frames, the reallocations counter can be used to verify it.
+ * This does not mean that no memory is allocated per frame: the inner contour vectors, the temporaries of OpenCV functions (findContours, getPerspectiveTransform, warpPerspective) and the grayscale conversion of color frames in some paths still allocate.
+ */
+class DetectorContext
+{
+	public:
+		/**
+		 * Grayscale buffer owned by the context, used when the frame has color.
+		 */
+		Mat luma;
+
+		/**
+		 * Grayscale version of the last frame, references the luma buffer or the frame itself for grayscale frames.
+		 */
+		Mat gray;
+
+		/**
+		 * Decimated grayscale image, used to search quads when decimation is enabled.
+		 */
+		Mat decimated;
+
+		/**
+		 * Binary image obtained from the adaptive threshold (of the decimated image when decimation is enabled).
+		 */
+		Mat thresh;
+
+		/**
+		 * Binary images obtained with each block size when multiple threshold block sizes are used.
+		 */
+		vector<Mat> thresholds;
+
+		/**
+		 * Block sizes used for each binary image, scaled to the decimated image.
+		 */
+		vector<int> blockSizes;
+
+		/**
+		 * Integral rows used by the multiple block sizes threshold.
+		 */
+		vector<uint32_t> integral;
+
+		/**
+		 * Column sums used by the adaptive threshold.
+		 */
+		vector<int> sums;
+
+		/**
+		 * Prefix sums used by the adaptive threshold.
+		 */
+		vector<int> prefix;
+
+		/**
+		 * Contours found in the binary image.
+		 */
+		vector<vector<Point>> contours;
+
+		/**
+		 * Polygon approximation of a contour.
+		 */
+		vector<Point> approx;
+
+		/**
+		 * Rejection counters of the quad search in the last frame.
+		 */
+		SquareFinderStats squareStats;
+
+		/**
+		 * Time spent in each stage in the last frame.
+		 */
+		FrameTimings timings;
+
+		/**
+		 * Buffers used by each thread to search quads in tiles.
+		 */
+		vector<ContourWorkspace> contourWorkspaces;
+
+		/**
+		 * Quads found in each tile.
+		 */
+		vector<vector<Quadrilateral>> tiles;
+
+		/**
+		 * Quads found in the last frame.
+		 */
+		vector<Quadrilateral> quads;
+
+		/**
+		 * Quads found with one threshold block size.
+		 */
+		vector<Quadrilateral> blockQuads;
+
+		/**
+		 * Regions searched when only the tracked markers are searched.
+		 */
+		vector<Rect> regions;
+
+		/**
+		 * Quads found in one region, in region coordinates.
+		 */
+		vector<Quadrilateral> regionQuads;
+
+		/**
+		 * Corners of all the quads, used to refine the corners found in the decimated image and the corners of the markers.
+		 */
+		vector<Point2f> corners;
+
+		/**
+		 * Edge profile buffers used to refine the corners of the markers.
+		 */
+		EdgeSamples edges;
+
+		/**
+		 * Grid over the quads of the last frame, used to find the quads nested inside other quads.
+		 */
+		QuadGrid grid;
+
+		/**
+		 * Smallest larger quad that contains the center of each quad, -1 if none.
+		 */
+		vector<int> owners;
+
+		/**
+		 * Nesting level of each quad (number of owners up to the outer quad), -1 for quads suppressed because they are inside a marker.
+		 */
+		vector<int> levels;
+
+		/**
+		 * Index of the quads decoded in one pass.
+		 */
+		vector<int> batch;
+
+		/**
+		 * Number of quads that were not decoded in the last frame because they are inside a marker.
+		 */
+		int suppressed;
+
+		/**
+		 * Buffers used by each decoding thread, indexed by the thread id.
+		 */
+		vector<DecoderWorkspace> workspaces;
+
+		/**
+		 * Decoded marker for each quad, same order as the quads.
+		 */
+		vector<ArucoMarker> candidates;
+
+		/**
+		 * Flag set for each candidate that was validated as a marker.
+		 */
+		vector<unsigned char> valid;
+
+		/**
+		 * Valid markers found in the last frame.
+		 */
+		vector<ArucoMarker> markers;
+
+		/**
+		 * Number of frames processed with this context.
+		 */
+		unsigned long frames;
+
+		/**
+		 * Number of times a buffer of the context moved in memory between two frames (allocated or reallocated).
+		 * Should stop increasing after the first frames when the input size is constant.
+		 * Only the data pointers of the context buffers are compared, a buffer reallocated at the same address is not counted.
+		 */
+		unsigned long reallocations;
+
+		/**
+		 * Context constructor.
+		 */
+		DetectorContext()
+		{
+			frames = 0;
+			reallocations = 0;
+			suppressed = 0;
+		}
+
+		/**
+		 * Resize the per thread workspaces and per candidate buffers before decoding.
+		 * @param threads Number of threads decoding.
+		 */
+		void prepareDecode(unsigned int threads)
+		{
+			if(workspaces.size() < threads)
+			{
+				workspaces.resize(threads);
+			}
+
+			candidates.resize(quads.size());
+			valid.assign(quads.size(), 0);
+		}
+
+		/**
+		 * Update the reallocations counter after a frame was processed.
+		 * Each buffer that moved in memory since the last frame counts as one reallocation.
+		 */
+		void track()
+		{
+			current.clear();
+			current.push_back(luma.data);
+			current.push_back(decimated.data);
+			current.push_back(thresh.data);
+			current.push_back(thresholds.data());
+			current.push_back(integral.data());
+			current.push_back(sums.data());
+			current.push_back(prefix.data());
+			current.push_back(contours.data());
+			current.push_back(approx.data());
+			current.push_back(contourWorkspaces.data());
+			current.push_back(tiles.data());
+			current.push_back(quads.data());
+			current.push_back(corners.data());
+			current.push_back(regions.data());
+			current.push_back(regionQuads.data());
+			current.push_back(blockQuads.data());
+			current.push_back(edges.x.data());
+			current.push_back(edges.y.data());
+			current.push_back(edges.value.data());
+			current.push_back(edges.points.data());
+			current.push_back(edges.weights.data());
+			current.push_back(grid.offsets.data());
+			current.push_back(grid.items.data());
+			current.push_back(grid.boxes.data());
+			current.push_back(grid.areas.data());
+			current.push_back(owners.data());
+			current.push_back(levels.data());
+			current.push_back(batch.data());
+			current.push_back(workspaces.data());
+			current.push_back(candidates.data());
+			current.push_back(valid.data());
+			current.push_back(markers.data());
+
+			for(unsigned int i = 0; i < thresholds.size(); i++)
+			{
+				current.push_back(thresholds[i].data);
+			}
+
+			for(unsigned int i = 0; i < workspaces.size(); i++)
+			{
+				current.push_back(workspaces[i].board.data);
+				current.push_back(workspaces[i].cells.data);
+				current.push_back(workspaces[i].binary.data);
+			}
+
+			for(unsigned int i = 0; i < current.size(); i++)
+			{
+				//Empty buffers that were never used are not reallocations
+				if(current[i] != NULL && (i >= buffers.size() || current[i] != buffers[i]))
+				{
+					reallocations++;
+				}
+			}
+
+			buffers.swap(current);
+			frames++;
+		}
+
+	private:
+		/**
+		 * Address of each buffer in the last frame.
+		 */
+		vector<const void*> buffers;
+
+		/**
+		 * Address of each buffer in the current frame.
+		 */
+		vector<const void*> current;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+using namespace std;
+
+/**
+ * Limits the number of frames processed at the same time by several cameras and grants the slots in the order they were requested.
+ *
+ * Each request takes a ticket, a ticket is served when fewer than the number of slots of the previous tickets are still being processed.
+ * Cameras waiting are served first come first served, so a camera with a high frame rate can not starve the others and the threads are not oversubscribed.
+ */
+class FairScheduler
+{
+	public:
+		/**
+		 * Holds a slot of the scheduler while it exists.
+		 */
+		class Slot
+		{
+			public:
+				/**
+				 * Time waited for the slot in seconds.
+				 */
+				double wait;
+
+				/**
+				 * Wait for a slot.
+				 * @param _scheduler Scheduler, if NULL the slot is granted immediately.
+				 */
+				Slot(FairScheduler *_scheduler)
+				{
+					scheduler = _scheduler;
+					wait = scheduler != NULL ? scheduler->acquire() : 0.0;
+				}
+
+				/**
+				 * Release the slot.
+				 */
+				~Slot()
+				{
+					if(scheduler != NULL)
+					{
+						scheduler->release();
+					}
+				}
+
+			private:
+				FairScheduler *scheduler;
+
+				Slot(const Slot&);
+				Slot &operator=(const Slot&);
+		};
+
+		/**
+		 * Fair scheduler constructor.
+		 * @param _slots Number of frames processed at the same time, usually the number of threads of the detection pool.
+		 */
+		FairScheduler(unsigned int _slots)
+		{
+			slots = _slots > 0 ? _slots : 1;
+			tickets = 0;
+			released = 0;
+		}
+
+		/**
+		 * Wait for a slot, slots are granted in the order they are requested.
+		 * @return Time waited in seconds.
+		 */
+		double acquire()
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			unique_lock<mutex> lock(ticketMutex);
+			unsigned long ticket = tickets++;
+
+			while(ticket >= released + slots)
+			{
+				ticketCondition.wait(lock);
+			}
+
+			return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+
+		/**
+		 * Release a slot acquired before.
+		 */
+		void release()
+		{
+			{
+				lock_guard<mutex> lock(ticketMutex);
+				released++;
+			}
+
+			ticketCondition.notify_all();
+		}
+
+	private:
+		/**
+		 * Number of slots.
+		 */
+		unsigned long slots;
+
+		/**
+		 * Number of tickets taken.
+		 */
+		unsigned long tickets;
+
+		/**
+		 * Number of slots released.
+		 */
+		unsigned long released;
+
+		mutex ticketMutex;
+		condition_variable ticketCondition;
+};
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <cstdlib>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "ArucoMarker.cpp"
+#include "ArucoDictionary.cpp"
+#include "CodeTable.cpp"
+#include "CellSampler.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Family of square markers with a black border and a grid of data cells decoded with a dictionary.
+ * Families are decoded directly from the grayscale image, by sampling the cells of the candidate quad.
+ */
+class MarkerFamily
+{
+	public:
+		/**
+		 * Name of the family.
+		 */
+		string name;
+
+		/**
+		 * Family constructor.
+		 * @param _name Name of the family.
+		 */
+		MarkerFamily(const string &_name)
+		{
+			name = _name;
+		}
+
+		virtual ~MarkerFamily() {}
+
+		/**
+		 * Number of data cells per side, without the border.
+		 * @return Number of data cells.
+		 */
+		virtual int cells() const = 0;
+
+		/**
+		 * Number of code words in the family.
+		 * @return Number of markers.
+		 */
+		virtual int size() const = 0;
+
+		/**
+		 * Read and decode a candidate quad.
+		 * On success the marker cells, id, distance and projected points are set and the marker is rotated to the code word orientation.
+		 * @param gray Grayscale image.
+		 * @param quad Quad points of the candidate.
+		 * @param marker Marker to fill.
+		 * @return True if the candidate is a marker of this family.
+		 */
+		virtual bool decode(const Mat &gray, const Point2f quad[4], ArucoMarker &marker) const = 0;
+
+		/**
+		 * Read code words from a text file, one code per line in decimal or hexadecimal (0x prefix).
+		 * Empty lines and lines starting with # are ignored.
+		 * Code words store the cell [i][j] in the bit i * N + j, tables that store the first cell in the most significant bit (apriltag, opencv) can be loaded with msbFirst.
+		 * @param path Path of the file.
+		 * @param bits Number of bits in each code word (N * N).
+		 * @param msbFirst If true the bit order of the codes is reversed.
+		 * @return Code words in the file order, empty if the file could not be read.
+		 */
+		static vector<uint64_t> readCodes(const string &path, int bits, bool msbFirst = false)
+		{
+			vector<uint64_t> codes;
+			ifstream file(path.c_str());
+			string line;
+
+			while(getline(file, line))
+			{
+				size_t start = line.find_first_not_of(" \t\r");
+				if(start == string::npos || line[start] == '#')
+				{
+					continue;
+				}
+
+				uint64_t code = strtoull(line.c_str() + start, NULL, 0);
+
+				if(msbFirst)
+				{
+					uint64_t reversed = 0;
+					for(int b = 0; b < bits; b++)
+					{
+						reversed |= ((code >> b) & 1) << (bits - 1 - b);
+					}
+					code = reversed;
+				}
+
+				codes.push_back(code);
+			}
+
+			return codes;
+		}
+};
+
+/**
+ * Marker family with NxN data cells (a (N + 2)x(N + 2) grid with the border) decoded with a CodeTable.
+ * The grid size is a template parameter, cell sampling, border check, payload extraction and table lookup are unrolled for each family.
+ * Any dictionary with up to 6x6 data cells and 1024 code words can be used (e.g. aruco 4x4, 5x5 and 6x6 dictionaries or apriltag 36h11).
+ */
+template<int N> class MarkerDictionary : public MarkerFamily
+{
+	public:
+		/**
+		 * Maximum number of white border cells accepted, for edge light bleed cases.
+		 */
+		int maxBorderErrors;
+
+		/**
+		 * Build the family lookup table.
+		 * @param _name Name of the family.
+		 * @param codes Code words with N * N bits, cell [i][j] in the bit i * N + j.
+		 * @param radius Maximum number of wrong data cells corrected.
+		 * @param _maxBorderErrors Maximum number of white border cells accepted.
+		 */
+		MarkerDictionary(const string &_name, const vector<uint64_t> &codes, int radius = 0, int _maxBorderErrors = 3) : MarkerFamily(_name), table(codes, radius)
+		{
+			count = (int)codes.size();
+			maxBorderErrors = _maxBorderErrors;
+		}
+
+		int cells() const
+		{
+			return N;
+		}
+
+		int size() const
+		{
+			return count;
+		}
+
+		bool decode(const Mat &gray, const Point2f quad[4], ArucoMarker &marker) const
+		{
+			const int S = N + 2;
+			int grid[S * S];
+
+			if(!CellSampler::read<S>(gray, quad, grid))
+			{
+				return false;
+			}
+
+			uint64_t bits = 0;
+			uint64_t payload = 0;
+			int border = 0;
+
+			for(int i = 0; i < S; i++)
+			{
+				for(int j = 0; j < S; j++)
+				{
+					uint64_t value = (uint64_t)grid[i * S + j];
+					bits |= value << (i * S + j);
+
+					if(i == 0 || j == 0 || i == S - 1 || j == S - 1)
+					{
+						border += (int)value;
+					}
+					else
+					{
+						payload |= value << ((i - 1) * N + (j - 1));
+					}
+				}
+			}
+
+			if(border > maxBorderErrors)
+			{
+				return false;
+			}
+
+			int id, turns, distance;
+			if(!table.decode(payload, id, turns, distance))
+			{
+				return false;
+			}
+
+			marker.bits = bits;
+			marker.size = S;
+			marker.rows = N;
+			marker.cols = N;
+			marker.rotation = 0;
+			marker.id = id;
+			marker.distance = distance;
+			marker.setProjected(quad);
+
+			for(int k = 0; k < turns; k++)
+			{
+				marker.rotate();
+			}
+
+			marker.validated = true;
+			return true;
+		}
+
+	private:
+		/**
+		 * Lookup table of the family code words.
+		 */
+		CodeTable<N> table;
+
+		/**
+		 * Number of code words.
+		 */
+		int count;
+};
+
+/**
+ * Set of marker families decoded by the detector.
+ * Each candidate quad is tested against the families in the order they were added, the first family that decodes it wins.
+ * Families are shared pointers so that the same (possibly large) lookup tables can be used by several detectors.
+ */
+class FamilyRegistry
+{
+	public:
+		/**
+		 * Families registered, the index is stored in ArucoMarker::family.
+		 */
+		vector<shared_ptr<MarkerFamily>> families;
+
+		/**
+		 * Add a family to the registry.
+		 * @param family Family to add.
+		 * @return Index of the family.
+		 */
+		int add(shared_ptr<MarkerFamily> family)
+		{
+			families.push_back(family);
+			return (int)families.size() - 1;
+		}
+
+		/**
+		 * Create and add a family from its code words, the template instance is selected from the number of data cells.
+		 * @param name Name of the family.
+		 * @param cells Number of data cells per side (between 3 and 6).
+		 * @param codes Code words, cell [i][j] in the bit i * cells + j.
+		 * @param radius Maximum number of wrong data cells corrected.
+		 * @return Index of the family, -1 if the number of cells is not supported or the number of code words is not between 1 and 1024.
+		 */
+		int add(const string &name, int cells, const vector<uint64_t> &codes, int radius = 0)
+		{
+			//The code tables hold the same number of code words for all the payload sizes
+			if(codes.empty() || codes.size() > (size_t)CodeTable<3>::MAX_CODES)
+			{
+				return -1;
+			}
+
+			switch(cells)
+			{
+				case 3: return add(make_shared<MarkerDictionary<3>>(name, codes, radius));
+				case 4: return add(make_shared<MarkerDictionary<4>>(name, codes, radius));
+				case 5: return add(make_shared<MarkerDictionary<5>>(name, codes, radius));
+				case 6: return add(make_shared<MarkerDictionary<6>>(name, codes, radius));
+			}
+
+			return -1;
+		}
+
+		/**
+		 * Add the original aruco 5x5 family (1024 markers).
+		 * @param radius Maximum number of wrong data cells corrected.
+		 * @return Index of the family.
+		 */
+		int addAruco(int radius = 0)
+		{
+			return add("aruco", 5, ArucoDictionary::codeWords(), radius);
+		}
+
+		/**
+		 * Check if there are no families registered.
+		 * @return True if empty.
+		 */
+		bool empty() const
+		{
+			return families.empty();
+		}
+
+		/**
+		 * Decode a candidate quad with the registered families.
+		 * @param gray Grayscale image.
+		 * @param quad Quad points of the candidate.
+		 * @param marker Marker to fill, the family index is stored in the marker.
+		 * @return True if any of the families decoded the candidate.
+		 */
+		bool decode(const Mat &gray, const Point2f quad[4], ArucoMarker &marker) const
+		{
+			for(unsigned int i = 0; i < families.size(); i++)
+			{
+				if(families[i]->decode(gray, quad, marker))
+				{
+					marker.family = i;
+					return true;
+				}
+			}
+
+			return false;
+		}
+};
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ArucoMarkerInfo.cpp"
+
+using namespace std;
+
+/**
+ * Header of a binary marker map file.
+ */
+struct MarkerMapHeader
+{
+	/**
+	 * File identifier, always "AMAP".
+	 */
+	char magic[4];
+
+	/**
+	 * Version of the format.
+	 */
+	uint32_t version;
+
+	/**
+	 * Number of markers stored after the header.
+	 */
+	uint32_t count;
+
+	/**
+	 * Size of each marker entry in bytes, used to check the layout.
+	 */
+	uint32_t entrySize;
+};
+
+/**
+ * Marker stored in a binary marker map file, with the world corners already calculated.
+ * All fields are naturally aligned so the entries can be used directly from the mapped file.
+ */
+struct MarkerMapEntry
+{
+	/**
+	 * Marker id.
+	 */
+	int32_t id;
+
+	/**
+	 * Unused, keeps the doubles aligned.
+	 */
+	int32_t reserved;
+
+	/**
+	 * Size of the marker.
+	 */
+	double size;
+
+	/**
+	 * Marker world position.
+	 */
+	double position[3];
+
+	/**
+	 * Marker world euler rotation.
+	 */
+	double rotation[3];
+
+	/**
+	 * World corners (x, y, z of each corner), same order as ArucoMarkerInfo.
+	 */
+	float world[12];
+};
+
+/**
+ * Read only binary marker map, the file is mapped in memory and the markers are used without parsing.
+ *
+ * The file is a MarkerMapHeader followed by the MarkerMapEntry of each marker (native byte order).
+ * Loading only maps the file, so the load time does not depend on the number of markers.
+ */
+class MarkerMap
+{
+	public:
+		/**
+		 * Current version of the format.
+		 */
+		static const uint32_t VERSION = 1;
+
+		/**
+		 * Markers of the map, points to the mapped file.
+		 */
+		const MarkerMapEntry *entries;
+
+		/**
+		 * Number of markers in the map.
+		 */
+		int count;
+
+		/**
+		 * Marker map constructor, empty map.
+		 */
+		MarkerMap()
+		{
+			entries = NULL;
+			count = 0;
+			data = NULL;
+			length = 0;
+		}
+
+		/**
+		 * Unmaps the file.
+		 */
+		~MarkerMap()
+		{
+			close();
+		}
+
+		/**
+		 * Map a marker map file, the previous file is unmapped.
+		 * @param path Path of the file.
+		 * @return False if the file could not be read or is not a valid marker map.
+		 */
+		bool open(const string &path)
+		{
+			close();
+
+			int file = ::open(path.c_str(), O_RDONLY);
+			if(file < 0)
+			{
+				return false;
+			}
+
+			struct stat info;
+			if(fstat(file, &info) != 0 || info.st_size < (off_t)sizeof(MarkerMapHeader))
+			{
+				::close(file);
+				return false;
+			}
+
+			void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			::close(file);
+
+			if(mapped == MAP_FAILED)
+			{
+				return false;
+			}
+
+			data = mapped;
+			length = info.st_size;
+
+			const MarkerMapHeader *header = (const MarkerMapHeader*)data;
+
+			if(memcmp(header->magic, "AMAP", 4) != 0 || header->version != VERSION || header->entrySize != sizeof(MarkerMapEntry) || length < sizeof(MarkerMapHeader) + (size_t)header->count * sizeof(MarkerMapEntry))
+			{
+				close();
+				return false;
+			}
+
+			entries = (const MarkerMapEntry*)((const char*)data + sizeof(MarkerMapHeader));
+			count = header->count;
+
+			return true;
+		}
+
+		/**
+		 * Unmap the file.
+		 */
+		void close()
+		{
+			if(data != NULL)
+			{
+				munmap(data, length);
+			}
+
+			entries = NULL;
+			count = 0;
+			data = NULL;
+			length = 0;
+		}
+
+		/**
+		 * Get the info of a marker of the map.
+		 * @param index Index of the marker in the map.
+		 * @param info Marker info, the world corners are copied from the map.
+		 */
+		void get(int index, ArucoMarkerInfo &info) const
+		{
+			const MarkerMapEntry &entry = entries[index];
+
+			info.id = entry.id;
+			info.size = entry.size;
+			info.position = Point3d(entry.position[0], entry.position[1], entry.position[2]);
+			info.rotation = Point3d(entry.rotation[0], entry.rotation[1], entry.rotation[2]);
+
+			for(int k = 0; k < 4; k++)
+			{
+				info.world[k] = Point3f(entry.world[k * 3], entry.world[k * 3 + 1], entry.world[k * 3 + 2]);
+			}
+		}
+
+		/**
+		 * Write a marker map file.
+		 * @param path Path of the file.
+		 * @param markers Markers to store, the world corners have to be calculated.
+		 * @return False if the file could not be written.
+		 */
+		static bool save(const string &path, const vector<ArucoMarkerInfo> &markers)
+		{
+			FILE *file = fopen(path.c_str(), "wb");
+			if(file == NULL)
+			{
+				return false;
+			}
+
+			MarkerMapHeader header;
+			memcpy(header.magic, "AMAP", 4);
+			header.version = VERSION;
+			header.count = markers.size();
+			header.entrySize = sizeof(MarkerMapEntry);
+
+			bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+			for(unsigned int i = 0; i < markers.size() && written; i++)
+			{
+				const ArucoMarkerInfo &info = markers[i];
+
+				MarkerMapEntry entry;
+				memset(&entry, 0, sizeof(entry));
+
+				entry.id = info.id;
+				entry.size = info.size;
+				entry.position[0] = info.position.x;
+				entry.position[1] = info.position.y;
+				entry.position[2] = info.position.z;
+				entry.rotation[0] = info.rotation.x;
+				entry.rotation[1] = info.rotation.y;
+				entry.rotation[2] = info.rotation.z;
+
+				for(int k = 0; k < 4; k++)
+				{
+					entry.world[k * 3] = info.world[k].x;
+					entry.world[k * 3 + 1] = info.world[k].y;
+					entry.world[k * 3 + 2] = info.world[k].z;
+				}
+
+				written = fwrite(&entry, sizeof(entry), 1, file) == 1;
+			}
+
+			return fclose(file) == 0 && written;
+		}
+
+	private:
+		/**
+		 * Mapped file.
+		 */
+		void *data;
+
+		/**
+		 * Size of the mapped file in bytes.
+		 */
+		size_t length;
+
+		/**
+		 * The map owns the mapped file, it can not be copied.
+		 */
+		MarkerMap(const MarkerMap&);
+		MarkerMap &operator=(const MarkerMap&);
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+#include "ArucoMarkerInfo.cpp"
+#include "MarkerMap.cpp"
+
+using namespace std;
+
+/**
+ * Immutable list of known markers indexed by marker id.
+ * Slots without a marker have id -1, the world corners of each marker are calculated when the marker is registered.
+ */
+class MarkerSnapshot
+{
+	public:
+		/**
+		 * Marker info of each id.
+		 */
+		vector<ArucoMarkerInfo> slots;
+
+		/**
+		 * Number of markers registered.
+		 */
+		int count;
+
+		/**
+		 * Marker snapshot constructor.
+		 * @param capacity Number of ids.
+		 */
+		MarkerSnapshot(int capacity = 0)
+		{
+			slots.resize(capacity);
+			count = 0;
+		}
+
+		/**
+		 * Get the info of a marker.
+		 * @param id Marker id.
+		 * @return Marker info, NULL if the marker is not registered.
+		 */
+		inline const ArucoMarkerInfo *find(int id) const
+		{
+			if(id < 0 || id >= (int)slots.size() || slots[id].id != id)
+			{
+				return NULL;
+			}
+
+			return &slots[id];
+		}
+};
+
+/**
+ * Registry of the known markers, can be read while markers are registered or removed from other threads.
+ *
+ * Readers take a snapshot (atomic load of a shared pointer) and use it for the whole frame without holding any lock.
+ * The atomic shared pointer functions are not lock free in libstdc++, they take a lock from a small global pool only while the pointer is copied, so readers never wait for a writer copying the snapshot.
+ * Writers copy the current snapshot, change the copy and publish it with an atomic store (read-copy-update), the old snapshot is released when the last reader drops it.
+ * Writers are serialized between them, registrations are rare so copying the snapshot is cheap compared to locking the frame path.
+ * Ids come from messages and map files, ids larger than maxId are rejected so a bad id can not allocate a huge snapshot.
+ */
+class MarkerRegistry
+{
+	public:
+		/**
+		 * Largest marker id accepted, by default 4095.
+		 */
+		int maxId;
+
+		/**
+		 * Marker registry constructor.
+		 * @param capacity Number of ids indexed initially, grows when a larger id is registered.
+		 * @param _maxId Largest marker id accepted.
+		 */
+		MarkerRegistry(int capacity = 1024, int _maxId = 4095)
+		{
+			maxId = _maxId;
+			current = make_shared<const MarkerSnapshot>(min(capacity, maxId + 1));
+		}
+
+		/**
+		 * Check if a marker id can be registered.
+		 * @param id Marker id.
+		 * @return True if the id is between 0 and maxId.
+		 */
+		bool accepts(int id) const
+		{
+			return id >= 0 && id <= maxId;
+		}
+
+		/**
+		 * Get the current snapshot of the registry, it does not change after being returned.
+		 * @return Snapshot of the registered markers.
+		 */
+		shared_ptr<const MarkerSnapshot> snapshot() const
+		{
+			return atomic_load(&current);
+		}
+
+		/**
+		 * Register a marker, replacing the marker with the same id if any.
+		 * Markers with an id that is not accepted are ignored, the caller should check the id with accepts().
+		 * @param info Marker info.
+		 * @return True if a marker with the same id was replaced.
+		 */
+		bool add(const ArucoMarkerInfo &info)
+		{
+			if(!accepts(info.id))
+			{
+				return false;
+			}
+
+			lock_guard<mutex> lock(writer);
+
+			shared_ptr<MarkerSnapshot> next = make_shared<MarkerSnapshot>(*atomic_load(&current));
+
+			if(info.id >= (int)next->slots.size())
+			{
+				next->slots.resize(info.id + 1);
+			}
+
+			bool replaced = next->slots[info.id].id == info.id;
+
+			next->slots[info.id] = info;
+			next->count += replaced ? 0 : 1;
+
+			atomic_store(&current, shared_ptr<const MarkerSnapshot>(next));
+
+			return replaced;
+		}
+
+		/**
+		 * Remove a marker.
+		 * @param id Marker id.
+		 * @return True if the marker was registered.
+		 */
+		bool remove(int id)
+		{
+			lock_guard<mutex> lock(writer);
+
+			shared_ptr<const MarkerSnapshot> last = atomic_load(&current);
+
+			if(last->find(id) == NULL)
+			{
+				return false;
+			}
+
+			shared_ptr<MarkerSnapshot> next = make_shared<MarkerSnapshot>(*last);
+			next->slots[id] = ArucoMarkerInfo();
+			next->count--;
+
+			atomic_store(&current, shared_ptr<const MarkerSnapshot>(next));
+
+			return true;
+		}
+
+		/**
+		 * Register all the markers of a marker map in a single update.
+		 * Markers with an id that is not accepted are skipped.
+		 * @param map Marker map.
+		 * @param replace If set the markers already registered are removed.
+		 * @param rejected Optional output, number of markers skipped because their id is not accepted.
+		 * @return Number of markers registered from the map.
+		 */
+		int load(const MarkerMap &map, bool replace = true, int *rejected = NULL)
+		{
+			lock_guard<mutex> lock(writer);
+
+			shared_ptr<MarkerSnapshot> next;
+
+			if(replace)
+			{
+				next = make_shared<MarkerSnapshot>(atomic_load(&current)->slots.size());
+			}
+			else
+			{
+				next = make_shared<MarkerSnapshot>(*atomic_load(&current));
+			}
+
+			int loaded = 0;
+			int skipped = 0;
+
+			for(int i = 0; i < map.count; i++)
+			{
+				int id = map.entries[i].id;
+
+				if(!accepts(id))
+				{
+					skipped++;
+					continue;
+				}
+
+				if(id >= (int)next->slots.size())
+				{
+					next->slots.resize(id + 1);
+				}
+
+				next->count += next->slots[id].id == id ? 0 : 1;
+				map.get(i, next->slots[id]);
+				loaded++;
+			}
+
+			atomic_store(&current, shared_ptr<const MarkerSnapshot>(next));
+
+			if(rejected != NULL)
+			{
+				*rejected = skipped;
+			}
+
+			return loaded;
+		}
+
+		/**
+		 * Get a copy of all the registered markers.
+		 * @return Registered markers ordered by id.
+		 */
+		vector<ArucoMarkerInfo> list() const
+		{
+			shared_ptr<const MarkerSnapshot> known = snapshot();
+			vector<ArucoMarkerInfo> markers;
+
+			for(unsigned int i = 0; i < known->slots.size(); i++)
+			{
+				if(known->slots[i].id >= 0)
+				{
+					markers.push_back(known->slots[i]);
+				}
+			}
+
+			return markers;
+		}
+
+		/**
+		 * Print the info of all registered markers to the stdout.
+		 */
+		void print() const
+		{
+			vector<ArucoMarkerInfo> markers = list();
+
+			for(unsigned int i = 0; i < markers.size(); i++)
+			{
+				markers[i].print();
+			}
+		}
+
+	private:
+		/**
+		 * Current snapshot, only accessed with the atomic shared pointer functions.
+		 */
+		shared_ptr<const MarkerSnapshot> current;
+
+		/**
+		 * Serializes the writers.
+		 */
+		mutex writer;
+};
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <vector>
+#include <math.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "ArucoMarker.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Marker being tracked across frames.
+ */
+class TrackedMarker
+{
+	public:
+		/**
+		 * Id of the marker.
+		 */
+		int id;
+
+		/**
+		 * Family of the marker.
+		 */
+		int family;
+
+		/**
+		 * Corners of the marker in the last frame it was seen.
+		 */
+		Point2f points[4];
+
+		/**
+		 * Displacement of the marker center between the last two frames it was seen.
+		 */
+		Point2f velocity;
+
+		/**
+		 * Tracked marker constructor.
+		 * @param marker Marker detected.
+		 */
+		TrackedMarker(const ArucoMarker &marker)
+		{
+			id = marker.id;
+			family = marker.family;
+			velocity = Point2f(0.0f, 0.0f);
+
+			for(int i = 0; i < 4; i++)
+			{
+				points[i] = marker.projected[i];
+			}
+		}
+
+		/**
+		 * Update the track with a new detection of the marker.
+		 * @param marker Marker detected.
+		 */
+		void update(const ArucoMarker &marker)
+		{
+			Point2f previous = center();
+
+			for(int i = 0; i < 4; i++)
+			{
+				points[i] = marker.projected[i];
+			}
+
+			velocity = center() - previous;
+		}
+
+		/**
+		 * Center of the marker corners.
+		 * @return Center point.
+		 */
+		Point2f center() const
+		{
+			return (points[0] + points[1] + points[2] + points[3]) * 0.25f;
+		}
+
+		/**
+		 * Position where the marker center is expected in the next frame.
+		 * @return Predicted center point.
+		 */
+		Point2f predictCenter() const
+		{
+			return center() + velocity;
+		}
+
+		/**
+		 * Region where the marker is expected in the next frame.
+		 * The bounding box of the corners is moved by the velocity and expanded by a margin relative to the marker size plus the speed.
+		 * @param margin Margin relative to the marker size.
+		 * @return Predicted region (not clipped to the frame).
+		 */
+		Rect predict(float margin) const
+		{
+			float minX = points[0].x, maxX = points[0].x;
+			float minY = points[0].y, maxY = points[0].y;
+
+			for(int i = 1; i < 4; i++)
+			{
+				minX = min(minX, points[i].x);
+				maxX = max(maxX, points[i].x);
+				minY = min(minY, points[i].y);
+				maxY = max(maxY, points[i].y);
+			}
+
+			float expand = max(maxX - minX, maxY - minY) * margin + (float)sqrt(velocity.x * velocity.x + velocity.y * velocity.y);
+
+			minX += velocity.x - expand;
+			maxX += velocity.x + expand;
+			minY += velocity.y - expand;
+			maxY += velocity.y + expand;
+
+			return Rect((int)floor(minX), (int)floor(minY), (int)ceil(maxX - minX) + 1, (int)ceil(maxY - minY) + 1);
+		}
+};
+
+/**
+ * Tracks markers across frames and decides where the detector has to search in the next frame.
+ * Between full frame scans only regions around the predicted position of each tracked marker are processed.
+ * A full frame scan runs every fullScanInterval frames (to find new markers) or when a tracked marker is lost.
+ */
+class MarkerTracker
+{
+	public:
+		/**
+		 * Markers being tracked.
+		 */
+		vector<TrackedMarker> tracks;
+
+		/**
+		 * Maximum number of frames between full frame scans.
+		 */
+		int fullScanInterval;
+
+		/**
+		 * Margin around each predicted marker region, relative to the marker size.
+		 */
+		float margin;
+
+		/**
+		 * Number of full frame scans performed.
+		 */
+		unsigned long fullScans;
+
+		/**
+		 * Number of frames processed only inside the tracked regions.
+		 */
+		unsigned long regionScans;
+
+		/**
+		 * Tracker constructor.
+		 * @param _fullScanInterval Maximum number of frames between full frame scans.
+		 * @param _margin Margin around each predicted marker region, relative to the marker size.
+		 */
+		MarkerTracker(int _fullScanInterval = 30, float _margin = 0.5f)
+		{
+			fullScanInterval = _fullScanInterval;
+			margin = _margin;
+			fullScans = 0;
+			regionScans = 0;
+			sinceFullScan = 0;
+		}
+
+		/**
+		 * Check if the next frame has to be fully scanned.
+		 * @return True if a full frame scan is needed.
+		 */
+		bool needsFullScan() const
+		{
+			return tracks.empty() || sinceFullScan + 1 >= fullScanInterval;
+		}
+
+		/**
+		 * Calculate the regions to search in the next frame.
+		 * Regions are clipped to the frame and overlapping regions are merged, so each marker is searched only once.
+		 * @param size Frame size.
+		 * @param regions Output regions.
+		 */
+		void predict(Size size, vector<Rect> &regions) const
+		{
+			Rect frame(0, 0, size.width, size.height);
+			regions.clear();
+
+			for(unsigned int i = 0; i < tracks.size(); i++)
+			{
+				Rect region = tracks[i].predict(margin) & frame;
+
+				if(region.area() > 0)
+				{
+					regions.push_back(region);
+				}
+			}
+
+			//Merge overlapping regions until none overlap
+			bool merged = true;
+			while(merged)
+			{
+				merged = false;
+
+				for(unsigned int i = 0; i < regions.size() && !merged; i++)
+				{
+					for(unsigned int j = i + 1; j < regions.size(); j++)
+					{
+						if((regions[i] & regions[j]).area() > 0)
+						{
+							regions[i] = regions[i] | regions[j];
+							regions.erase(regions.begin() + j);
+							merged = true;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		/**
+		 * Update the tracks with the markers found in a frame.
+		 * After a full scan the tracks are replaced by the markers found, after a region scan all tracks have to be found again.
+		 * A region scan that lost a marker is not counted, the frame is counted by the full scan that follows.
+		 * @param markers Markers found.
+		 * @param full True if the frame was fully scanned.
+		 * @return False if a region scan lost one of the tracked markers.
+		 */
+		bool update(const vector<ArucoMarker> &markers, bool full)
+		{
+			int found = 0;
+			next.clear();
+			matched.assign(tracks.size(), 0);
+
+			for(unsigned int i = 0; i < markers.size(); i++)
+			{
+				int track = find(markers[i]);
+
+				if(track >= 0)
+				{
+					matched[track] = 1;
+					next.push_back(tracks[track]);
+					next.back().update(markers[i]);
+					found++;
+				}
+				else
+				{
+					next.push_back(TrackedMarker(markers[i]));
+				}
+			}
+
+			if(!full && found < (int)tracks.size())
+			{
+				return false;
+			}
+
+			if(full)
+			{
+				fullScans++;
+				sinceFullScan = 0;
+			}
+			else
+			{
+				regionScans++;
+				sinceFullScan++;
+			}
+
+			tracks.swap(next);
+			return true;
+		}
+
+		/**
+		 * Drop all tracks, the next frame is fully scanned.
+		 */
+		void reset()
+		{
+			tracks.clear();
+			sinceFullScan = 0;
+		}
+
+	private:
+		/**
+		 * Frames processed since the last full scan.
+		 */
+		int sinceFullScan;
+
+		/**
+		 * Tracks being built by update(), kept to reuse its memory.
+		 */
+		vector<TrackedMarker> next;
+
+		/**
+		 * Tracks already matched to a marker of the frame being updated.
+		 */
+		vector<char> matched;
+
+		/**
+		 * Find the track of a marker.
+		 * The track has to have the same id and family and the marker center has to be inside the predicted region of the track.
+		 * When more than one track matches (the same marker printed more than once) the track with the predicted center closest to the marker is used, each track is matched once.
+		 * @param marker Marker to find.
+		 * @return Index of the track or -1 if the marker is not tracked.
+		 */
+		int find(const ArucoMarker &marker) const
+		{
+			Point2f position = (marker.projected[0] + marker.projected[1] + marker.projected[2] + marker.projected[3]) * 0.25f;
+
+			int best = -1;
+			float bestDistance = 0.0f;
+
+			for(unsigned int i = 0; i < tracks.size(); i++)
+			{
+				if(matched[i] || tracks[i].id != marker.id || tracks[i].family != marker.family || !tracks[i].predict(margin).contains(position))
+				{
+					continue;
+				}
+
+				Point2f delta = position - tracks[i].predictCenter();
+				float distance = delta.x * delta.x + delta.y * delta.y;
+
+				if(best < 0 || distance < bestDistance)
+				{
+					best = i;
+					bestDistance = distance;
+				}
+			}
+
+			return best;
+		}
+};
@@ -0,0 +1,669 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <math.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "ArucoMarker.cpp"
+#include "CameraModel.cpp"
+#include "math/PlanarPose.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Estimates the camera pose from multiple markers with known world position.
+ *
+ * The pose of each marker is first obtained in closed form (PlanarPoseSolver) and converted to a camera pose hypothesis using the marker world corners.
+ * The pose of the previous frame is also used as an hypothesis (warm start).
+ * Each hypothesis is scored by the number of markers it reprojects within the inlier threshold (consensus), markers that disagree with the best hypothesis are rejected.
+ * The best hypothesis is refined with Levenberg-Marquardt over the corners of the inlier markers, starting near the solution it usually converges in one or two iterations.
+ *
+ * The pose maps world points to camera coordinates (same as solvePnP).
+ */
+class MultiMarkerPose
+{
+	public:
+		/**
+		 * Maximum RMS reprojection error of the corners of a marker (in pixels) to agree with a pose.
+		 */
+		double inlierThreshold;
+
+		/**
+		 * Maximum number of Levenberg-Marquardt iterations.
+		 */
+		int maxIterations;
+
+		/**
+		 * If set the pose of the previous frame is used as an hypothesis.
+		 */
+		bool warmStart;
+
+		/**
+		 * Pose estimated in the last call to solve, error is the RMS reprojection error of the inlier corners.
+		 */
+		PlanarPose pose;
+
+		/**
+		 * Indicates if the last pose is valid (used for warm start).
+		 */
+		bool valid;
+
+		/**
+		 * Flag set for the markers used in the last pose (consensus inliers), in the same order as the markers.
+		 */
+		vector<unsigned char> inlier;
+
+		/**
+		 * Number of markers used in the last pose.
+		 */
+		int inliers;
+
+		/**
+		 * Number of markers rejected in the last pose.
+		 */
+		int outliers;
+
+		/**
+		 * Number of Levenberg-Marquardt iterations used in the last pose.
+		 */
+		int iterations;
+
+		/**
+		 * Indicates if the last pose was seeded from the previous frame pose.
+		 */
+		bool warmStarted;
+
+		/**
+		 * Time spent in the last solve in seconds.
+		 */
+		double time;
+
+		/**
+		 * Per marker closed form poses of the last solve.
+		 */
+		PlanarPoseSolver solver;
+
+		/**
+		 * Multi marker pose constructor.
+		 * @param _inlierThreshold Maximum marker reprojection error in pixels.
+		 * @param _maxIterations Maximum number of refinement iterations.
+		 */
+		MultiMarkerPose(double _inlierThreshold = 4.0, int _maxIterations = 10)
+		{
+			inlierThreshold = _inlierThreshold;
+			maxIterations = _maxIterations;
+			warmStart = true;
+			valid = false;
+			inliers = 0;
+			outliers = 0;
+			iterations = 0;
+			warmStarted = false;
+			time = 0.0;
+		}
+
+		/**
+		 * Forget the previous pose, the next solve is not warm started.
+		 */
+		void reset()
+		{
+			valid = false;
+		}
+
+		/**
+		 * Estimate the camera pose from markers with known world corners (info attached).
+		 * @param markers Markers visible in the frame.
+		 * @param camera Camera intrinsic calibration matrix.
+		 * @param distortion Camera distortion calibration matrix.
+		 * @return True if a pose was found.
+		 */
+		bool solve(const vector<ArucoMarker> &markers, Mat camera, Mat distortion)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			//Closed form pose of each marker, also undistorts all the corners
+			gather(markers);
+			solver.solve(camera, distortion);
+
+			Mat intrinsic;
+			camera.convertTo(intrinsic, CV_64F);
+
+			return solveUndistorted(markers, intrinsic.at<double>(0, 0), intrinsic.at<double>(1, 1), start);
+		}
+
+		/**
+		 * Estimate the camera pose from markers with known world corners (info attached).
+		 * The corners are undistorted using the lookup table of the camera model.
+		 * @param markers Markers visible in the frame.
+		 * @param camera Camera model with the lookup table built.
+		 * @return True if a pose was found.
+		 */
+		bool solve(const vector<ArucoMarker> &markers, const CameraModel &camera)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			gather(markers);
+			solver.x.resize(solver.corners.size());
+			solver.y.resize(solver.corners.size());
+
+			if(!solver.corners.empty())
+			{
+				camera.undistort(&solver.corners[0], solver.corners.size(), &solver.x[0], &solver.y[0]);
+			}
+
+			solver.solveNormalized(camera.fx, camera.fy);
+
+			return solveUndistorted(markers, camera.fx, camera.fy, start);
+		}
+
+	private:
+		/**
+		 * Focal length of the camera, used to measure the reprojection error in pixels.
+		 */
+		double fx, fy;
+
+		/**
+		 * World coordinates of the corners, 4 per marker.
+		 */
+		vector<double> wx, wy, wz;
+
+		/**
+		 * Add the corners of the markers to the solver batch.
+		 */
+		void gather(const vector<ArucoMarker> &markers)
+		{
+			solver.clear();
+
+			for(unsigned int i = 0; i < markers.size(); i++)
+			{
+				solver.add(markers[i].projected, markers[i].info.size);
+			}
+		}
+
+		/**
+		 * Estimate the camera pose after the solver has the undistorted corners and the closed form pose of each marker.
+		 * @param markers Markers visible in the frame.
+		 * @param _fx Focal length in x.
+		 * @param _fy Focal length in y.
+		 * @param start Time when the solve started.
+		 * @return True if a pose was found.
+		 */
+		bool solveUndistorted(const vector<ArucoMarker> &markers, double _fx, double _fy, chrono::steady_clock::time_point start)
+		{
+			int count = markers.size();
+			inlier.assign(count, 0);
+			inliers = 0;
+			outliers = count;
+			iterations = 0;
+			warmStarted = false;
+
+			fx = _fx;
+			fy = _fy;
+
+			wx.resize(count * 4);
+			wy.resize(count * 4);
+			wz.resize(count * 4);
+
+			for(int i = 0; i < count * 4; i++)
+			{
+				const Point3f &w = markers[i / 4].info.world[i % 4];
+				wx[i] = w.x;
+				wy[i] = w.y;
+				wz[i] = w.z;
+			}
+
+			//Consensus between the pose hypotheses
+			PlanarPose best;
+			int bestInliers = 0;
+			double bestError = 0.0;
+
+			if(warmStart && valid)
+			{
+				bestInliers = score(pose, bestError);
+				warmStarted = bestInliers > 0;
+				best = pose;
+			}
+
+			//The previous pose only needs to be replaced if some marker disagrees with it
+			if(bestInliers < count)
+			{
+				for(int i = 0; i < count; i++)
+				{
+					if(!solver.valid[i])
+					{
+						continue;
+					}
+
+					for(int k = 0; k < 2; k++)
+					{
+						PlanarPose hypothesis;
+						toWorld(markers[i].info, k == 0 ? solver.first[i] : solver.second[i], hypothesis);
+
+						double error;
+						int agree = score(hypothesis, error);
+
+						if(agree > bestInliers || (agree == bestInliers && error < bestError))
+						{
+							best = hypothesis;
+							bestInliers = agree;
+							bestError = error;
+							warmStarted = false;
+						}
+					}
+				}
+			}
+
+			valid = bestInliers > 0;
+
+			if(valid)
+			{
+				//Inlier markers of the best hypothesis
+				score(best, bestError, &inlier[0]);
+				inliers = bestInliers;
+				outliers = count - inliers;
+
+				refine(best);
+				pose = best;
+			}
+
+			time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			return valid;
+		}
+
+		/**
+		 * Convert the pose of a marker (relative to its center) to the pose of the world using the marker world corners.
+		 * The marker frame is rebuilt from its world corners (x from corner 0 to 3, y from corner 0 to 1), so it works with any world position and rotation.
+		 * @param info Marker info with the world corners.
+		 * @param local Pose of the marker center.
+		 * @param world Pose of the world.
+		 */
+		static void toWorld(const ArucoMarkerInfo &info, const PlanarPose &local, PlanarPose &world)
+		{
+			const Point3f *w = info.world;
+
+			double c[3] = {(w[0].x + w[1].x + w[2].x + w[3].x) * 0.25, (w[0].y + w[1].y + w[2].y + w[3].y) * 0.25, (w[0].z + w[1].z + w[2].z + w[3].z) * 0.25};
+
+			//Marker axes in world coordinates (orthonormalized)
+			double ex[3] = {(w[3].x - w[0].x) + (w[2].x - w[1].x), (w[3].y - w[0].y) + (w[2].y - w[1].y), (w[3].z - w[0].z) + (w[2].z - w[1].z)};
+			double ey[3] = {(w[1].x - w[0].x) + (w[2].x - w[3].x), (w[1].y - w[0].y) + (w[2].y - w[3].y), (w[1].z - w[0].z) + (w[2].z - w[3].z)};
+
+			normalize(ex);
+			double d = ex[0] * ey[0] + ex[1] * ey[1] + ex[2] * ey[2];
+			ey[0] -= d * ex[0];
+			ey[1] -= d * ex[1];
+			ey[2] -= d * ex[2];
+			normalize(ey);
+
+			double ez[3] = {ex[1] * ey[2] - ex[2] * ey[1], ex[2] * ey[0] - ex[0] * ey[2], ex[0] * ey[1] - ex[1] * ey[0]};
+
+			//R = Rlocal * [ex ey ez]^T, t = tlocal - R * c
+			const double *r = local.rotation;
+
+			for(int i = 0; i < 3; i++)
+			{
+				for(int j = 0; j < 3; j++)
+				{
+					world.rotation[i * 3 + j] = r[i * 3] * ex[j] + r[i * 3 + 1] * ey[j] + r[i * 3 + 2] * ez[j];
+				}
+			}
+
+			for(int i = 0; i < 3; i++)
+			{
+				const double *row = &world.rotation[i * 3];
+				world.translation[i] = local.translation[i] - (row[0] * c[0] + row[1] * c[1] + row[2] * c[2]);
+			}
+		}
+
+		/**
+		 * Normalize a 3D vector.
+		 */
+		static void normalize(double *v)
+		{
+			double length = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+			if(length > 0.0)
+			{
+				v[0] /= length;
+				v[1] /= length;
+				v[2] /= length;
+			}
+		}
+
+		/**
+		 * Count the markers that agree with a pose.
+		 * @param hypothesis Pose to evaluate.
+		 * @param error Sum of the squared reprojection error of the corners of the agreeing markers in pixels.
+		 * @param flags Optional output flag for each marker that agrees.
+		 * @return Number of markers that agree with the pose.
+		 */
+		int score(const PlanarPose &hypothesis, double &error, unsigned char *flags = NULL) const
+		{
+			const double *r = hypothesis.rotation;
+			const double *t = hypothesis.translation;
+			double limit = inlierThreshold * inlierThreshold * 4.0;
+
+			int count = wx.size() / 4;
+			int agree = 0;
+			error = 0.0;
+
+			for(int i = 0; i < count; i++)
+			{
+				double sum = 0.0;
+
+				for(int k = i * 4; k < i * 4 + 4; k++)
+				{
+					double px = r[0] * wx[k] + r[1] * wy[k] + r[2] * wz[k] + t[0];
+					double py = r[3] * wx[k] + r[4] * wy[k] + r[5] * wz[k] + t[1];
+					double pz = r[6] * wx[k] + r[7] * wy[k] + r[8] * wz[k] + t[2];
+
+					if(pz <= 0.0)
+					{
+						sum = limit;
+						break;
+					}
+
+					double dx = (px / pz - solver.x[k]) * fx;
+					double dy = (py / pz - solver.y[k]) * fy;
+					sum += dx * dx + dy * dy;
+				}
+
+				if(sum < limit)
+				{
+					agree++;
+					error += sum;
+				}
+
+				if(flags != NULL)
+				{
+					flags[i] = sum < limit;
+				}
+			}
+
+			return agree;
+		}
+
+		/**
+		 * Sum of the squared reprojection error of the inlier corners in pixels, and normal equations of the pose update.
+		 * The update is a rotation (small angle, applied on the left) followed by a translation.
+		 * @param current Pose to evaluate.
+		 * @param jtj Normal matrix (6x6, by rows), not computed if NULL.
+		 * @param jte Gradient (6), not computed if NULL.
+		 * @return Sum of the squared error.
+		 */
+		double normalEquations(const PlanarPose &current, double *jtj, double *jte) const
+		{
+			const double *r = current.rotation;
+			const double *t = current.translation;
+
+			if(jtj != NULL)
+			{
+				for(int i = 0; i < 36; i++)
+				{
+					jtj[i] = 0.0;
+				}
+
+				for(int i = 0; i < 6; i++)
+				{
+					jte[i] = 0.0;
+				}
+			}
+
+			double cost = 0.0;
+			int count = wx.size();
+
+			for(int k = 0; k < count; k++)
+			{
+				if(!inlier[k / 4])
+				{
+					continue;
+				}
+
+				//Rotated point and camera point
+				double qx = r[0] * wx[k] + r[1] * wy[k] + r[2] * wz[k];
+				double qy = r[3] * wx[k] + r[4] * wy[k] + r[5] * wz[k];
+				double qz = r[6] * wx[k] + r[7] * wy[k] + r[8] * wz[k];
+
+				double px = qx + t[0];
+				double py = qy + t[1];
+				double pz = qz + t[2];
+				double iz = 1.0 / pz;
+
+				double ex = (px * iz - solver.x[k]) * fx;
+				double ey = (py * iz - solver.y[k]) * fy;
+				cost += ex * ex + ey * ey;
+
+				if(jtj == NULL)
+				{
+					continue;
+				}
+
+				//Jacobian of the projection, d(p)/d(w) = -[q]x, d(p)/d(t) = I
+				double ju[6], jv[6];
+				double ux = fx * iz, uz = -fx * px * iz * iz;
+				double vy = fy * iz, vz = -fy * py * iz * iz;
+
+				ju[0] = uz * qy;
+				ju[1] = ux * qz - uz * qx;
+				ju[2] = -ux * qy;
+				ju[3] = ux;
+				ju[4] = 0.0;
+				ju[5] = uz;
+
+				jv[0] = -vy * qz + vz * qy;
+				jv[1] = -vz * qx;
+				jv[2] = vy * qx;
+				jv[3] = 0.0;
+				jv[4] = vy;
+				jv[5] = vz;
+
+				for(int i = 0; i < 6; i++)
+				{
+					for(int j = i; j < 6; j++)
+					{
+						jtj[i * 6 + j] += ju[i] * ju[j] + jv[i] * jv[j];
+					}
+
+					jte[i] += ju[i] * ex + jv[i] * ey;
+				}
+			}
+
+			if(jtj != NULL)
+			{
+				for(int i = 0; i < 6; i++)
+				{
+					for(int j = 0; j < i; j++)
+					{
+						jtj[i * 6 + j] = jtj[j * 6 + i];
+					}
+				}
+			}
+
+			return cost;
+		}
+
+		/**
+		 * Refine a pose using Levenberg-Marquardt over the corners of the inlier markers.
+		 * @param current Pose to refine, also used as starting point.
+		 */
+		void refine(PlanarPose &current)
+		{
+			double jtj[36], jte[6], a[36], delta[6];
+			double lambda = 1e-3;
+			double cost = normalEquations(current, jtj, jte);
+
+			bool converged = false;
+
+			while(!converged && iterations < maxIterations)
+			{
+				iterations++;
+
+				bool improved = false;
+
+				//Increase the damping until the step reduces the error
+				for(int attempt = 0; attempt < 10 && !improved; attempt++)
+				{
+					for(int i = 0; i < 36; i++)
+					{
+						a[i] = jtj[i];
+					}
+
+					for(int i = 0; i < 6; i++)
+					{
+						a[i * 6 + i] += lambda * (jtj[i * 6 + i] + 1e-9);
+						delta[i] = -jte[i];
+					}
+
+					if(!cholesky(a, delta))
+					{
+						lambda *= 10.0;
+						continue;
+					}
+
+					PlanarPose candidate = current;
+					update(candidate, delta);
+
+					double candidateCost = normalEquations(candidate, NULL, NULL);
+
+					if(candidateCost < cost)
+					{
+						//Converged when the error or the step are negligible
+						double step = 0.0;
+						for(int i = 0; i < 6; i++)
+						{
+							step += delta[i] * delta[i];
+						}
+
+						converged = cost - candidateCost < 1e-6 * cost || step < 1e-16;
+
+						current = candidate;
+						cost = normalEquations(current, jtj, jte);
+						lambda = max(lambda * 0.1, 1e-9);
+						improved = true;
+					}
+					else
+					{
+						lambda *= 10.0;
+					}
+				}
+
+				if(!improved)
+				{
+					break;
+				}
+			}
+
+			int corners = inliers * 4;
+			current.error = corners > 0 ? sqrt(cost / corners) : 0.0;
+		}
+
+		/**
+		 * Apply a pose update, the rotation is applied on the left of the current rotation (Rodrigues formula).
+		 * @param current Pose to update.
+		 * @param delta Update (rotation vector and translation).
+		 */
+		static void update(PlanarPose &current, const double *delta)
+		{
+			double ax = delta[0], ay = delta[1], az = delta[2];
+			double theta = sqrt(ax * ax + ay * ay + az * az);
+
+			double s, c;
+			if(theta < 1e-12)
+			{
+				s = 1.0;
+				c = 0.5;
+			}
+			else
+			{
+				s = sin(theta) / theta;
+				c = (1.0 - cos(theta)) / (theta * theta);
+			}
+
+			double e[9] = {
+				1.0 - c * (ay * ay + az * az), -s * az + c * ax * ay, s * ay + c * ax * az,
+				s * az + c * ax * ay, 1.0 - c * (ax * ax + az * az), -s * ax + c * ay * az,
+				-s * ay + c * ax * az, s * ax + c * ay * az, 1.0 - c * (ax * ax + ay * ay)
+			};
+
+			double r[9];
+
+			for(int i = 0; i < 3; i++)
+			{
+				for(int j = 0; j < 3; j++)
+				{
+					r[i * 3 + j] = e[i * 3] * current.rotation[j] + e[i * 3 + 1] * current.rotation[3 + j] + e[i * 3 + 2] * current.rotation[6 + j];
+				}
+			}
+
+			for(int i = 0; i < 9; i++)
+			{
+				current.rotation[i] = r[i];
+			}
+
+			//The rotation is around the world origin, the translation is only changed by the translation update
+			for(int i = 0; i < 3; i++)
+			{
+				current.translation[i] += delta[3 + i];
+			}
+		}
+
+		/**
+		 * Solve a 6x6 symmetric positive definite system in place (Cholesky decomposition).
+		 * @param a Matrix by rows, overwritten by the decomposition.
+		 * @param b Right side, overwritten by the solution.
+		 * @return False if the matrix is not positive definite.
+		 */
+		static bool cholesky(double *a, double *b)
+		{
+			for(int i = 0; i < 6; i++)
+			{
+				for(int j = 0; j <= i; j++)
+				{
+					double sum = a[i * 6 + j];
+
+					for(int k = 0; k < j; k++)
+					{
+						sum -= a[i * 6 + k] * a[j * 6 + k];
+					}
+
+					if(i == j)
+					{
+						if(sum <= 0.0)
+						{
+							return false;
+						}
+
+						a[i * 6 + i] = sqrt(sum);
+					}
+					else
+					{
+						a[i * 6 + j] = sum / a[j * 6 + j];
+					}
+				}
+			}
+
+			for(int i = 0; i < 6; i++)
+			{
+				for(int k = 0; k < i; k++)
+				{
+					b[i] -= a[i * 6 + k] * b[k];
+				}
+
+				b[i] /= a[i * 6 + i];
+			}
+
+			for(int i = 5; i >= 0; i--)
+			{
+				for(int k = i + 1; k < 6; k++)
+				{
+					b[i] -= a[k * 6 + i] * b[k];
+				}
+
+				b[i] /= a[i * 6 + i];
+			}
+
+			return true;
+		}
+};
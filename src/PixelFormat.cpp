@@ -0,0 +1,331 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Luma of color pixels, using the same fixed point coefficients as cvtColor.
+ * @tparam BLUE Index of the blue channel.
+ * @tparam RED Index of the red channel.
+ * @tparam CHANNELS Number of channels of each pixel.
+ */
+template<int BLUE, int RED, int CHANNELS>
+struct ColorPixels
+{
+	static inline void row(const Mat &frame, int y, uchar *dst, int shift)
+	{
+		const uchar *src = frame.ptr<uchar>(y);
+
+		for(int x = 0; x < frame.cols; x++, src += CHANNELS)
+		{
+			dst[x] = (uchar)((src[BLUE] * 1868 + src[1] * 9617 + src[RED] * 4899 + (1 << 13)) >> 14);
+		}
+	}
+};
+
+/**
+ * Luma of packed YUV 4:2:2 pixels (two channels, luma and alternating chroma), read directly without conversion.
+ * @tparam LUMA Index of the luma byte in each pixel (0 for YUYV, 1 for UYVY).
+ */
+template<int LUMA>
+struct PackedPixels
+{
+	static inline void row(const Mat &frame, int y, uchar *dst, int shift)
+	{
+		const uchar *src = frame.ptr<uchar>(y) + LUMA;
+
+		for(int x = 0; x < frame.cols; x++)
+		{
+			dst[x] = src[x * 2];
+		}
+	}
+};
+
+/**
+ * 16 bit grayscale pixels, reduced to 8 bit with a right shift (saturated).
+ */
+struct WidePixels
+{
+	static inline void row(const Mat &frame, int y, uchar *dst, int shift)
+	{
+		const uint16_t *src = frame.ptr<uint16_t>(y);
+
+		for(int x = 0; x < frame.cols; x++)
+		{
+			dst[x] = (uchar)min(src[x] >> shift, 255);
+		}
+	}
+};
+
+/**
+ * Luma estimate of raw Bayer pixels at full resolution, without demosaicing.
+ * The mosaic is filtered with the [1 2 1] x [1 2 1] / 16 kernel, any 3x3 window of the mosaic weights red, green and blue as 1/4, 1/2 and 1/4 whatever the pattern and phase, so the result is (R + 2G + B) / 4 at every pixel.
+ * The border is reflected (without repeating the edge pixel) so it keeps the phase of the pattern.
+ */
+struct BayerPixels
+{
+	static inline int reflect(int i, int size)
+	{
+		if(i < 0)
+		{
+			return min(-i, size - 1);
+		}
+
+		if(i >= size)
+		{
+			return max(2 * size - 2 - i, 0);
+		}
+
+		return i;
+	}
+
+	static inline uchar luma(const uchar *above, const uchar *center, const uchar *below, int left, int x, int right)
+	{
+		int sum = above[left] + 2 * above[x] + above[right];
+		sum += 2 * (center[left] + 2 * center[x] + center[right]);
+		sum += below[left] + 2 * below[x] + below[right];
+
+		return (uchar)((sum + 8) >> 4);
+	}
+
+	static inline void row(const Mat &frame, int y, uchar *dst, int shift)
+	{
+		const uchar *above = frame.ptr<uchar>(reflect(y - 1, frame.rows));
+		const uchar *center = frame.ptr<uchar>(y);
+		const uchar *below = frame.ptr<uchar>(reflect(y + 1, frame.rows));
+		int cols = frame.cols;
+
+		//Interior columns without border checks, so the loop can be vectorized
+		for(int x = 1; x < cols - 1; x++)
+		{
+			dst[x] = luma(above, center, below, x - 1, x, x + 1);
+		}
+
+		dst[0] = luma(above, center, below, reflect(-1, cols), 0, reflect(1, cols));
+
+		if(cols > 1)
+		{
+			dst[cols - 1] = luma(above, center, below, cols - 2, cols - 1, reflect(cols, cols));
+		}
+	}
+};
+
+/**
+ * Pixel format of the frames given to the detector.
+ * The detector only uses the luma of the frame, formats that store a luma plane are used without conversion and the others are converted one row at a time while the frame is thresholded.
+ * The row conversion of each format is a pixel accessor (ColorPixels, PackedPixels, WidePixels, BayerPixels) instantiated once, the format is dispatched once per call and not per pixel.
+ */
+class PixelFormat
+{
+	public:
+		/**
+		 * Formats supported.
+		 */
+		enum Format
+		{
+			/**
+			 * Selected from the type of the frame, CV_8UC1 grayscale, CV_8UC3 BGR, CV_8UC4 BGRA and CV_16UC1 16 bit grayscale.
+			 */
+			FORMAT_AUTO = 0,
+
+			/**
+			 * 8 bit grayscale (CV_8UC1), used as is.
+			 */
+			FORMAT_GRAY = 1,
+
+			/**
+			 * BGR (CV_8UC3).
+			 */
+			FORMAT_BGR = 2,
+
+			/**
+			 * RGB (CV_8UC3).
+			 */
+			FORMAT_RGB = 3,
+
+			/**
+			 * BGRA (CV_8UC4).
+			 */
+			FORMAT_BGRA = 4,
+
+			/**
+			 * RGBA (CV_8UC4).
+			 */
+			FORMAT_RGBA = 5,
+
+			/**
+			 * 16 bit grayscale (CV_16UC1), reduced to 8 bit with the depth shift.
+			 */
+			FORMAT_GRAY16 = 6,
+
+			/**
+			 * Packed YUV 4:2:2 with the luma first (CV_8UC2, YUYV or YUY2).
+			 */
+			FORMAT_YUYV = 7,
+
+			/**
+			 * Packed YUV 4:2:2 with the chroma first (CV_8UC2, UYVY).
+			 */
+			FORMAT_UYVY = 8,
+
+			/**
+			 * Semi planar YUV 4:2:0 (CV_8UC1 with the chroma rows after the luma rows, NV12 or NV21), the luma plane is used as is.
+			 */
+			FORMAT_NV12 = 9,
+
+			/**
+			 * Raw Bayer mosaic of any pattern (CV_8UC1).
+			 */
+			FORMAT_BAYER = 10
+		};
+
+		/**
+		 * Format of the frames.
+		 */
+		int format;
+
+		/**
+		 * Right shift used to reduce 16 bit pixels to 8 bit (8 for pixels that use the full 16 bits, 4 for 12 bit sensors).
+		 */
+		int depthShift;
+
+		/**
+		 * Pixel format constructor.
+		 * @param _format Format of the frames.
+		 * @param _depthShift Right shift of 16 bit pixels.
+		 */
+		PixelFormat(int _format = FORMAT_AUTO, int _depthShift = 8)
+		{
+			format = _format;
+			depthShift = _depthShift;
+		}
+
+		/**
+		 * Get the format of a frame, resolving the automatic format from the type of the frame.
+		 * @param frame Frame.
+		 * @return Format of the frame.
+		 */
+		int resolve(const Mat &frame) const
+		{
+			if(format != FORMAT_AUTO)
+			{
+				return format;
+			}
+
+			if(frame.depth() == CV_16U)
+			{
+				return FORMAT_GRAY16;
+			}
+
+			return frame.channels() == 4 ? FORMAT_BGRA : (frame.channels() == 3 ? FORMAT_BGR : FORMAT_GRAY);
+		}
+
+		/**
+		 * Get the part of the frame that is an image, for semi planar formats the luma plane (without copy).
+		 * @param frame Frame.
+		 * @return Image of the frame.
+		 */
+		Mat plane(const Mat &frame) const
+		{
+			if(format == FORMAT_NV12)
+			{
+				return frame.rowRange(0, frame.rows * 2 / 3);
+			}
+
+			return frame;
+		}
+
+		/**
+		 * Check if the image can be used as the luma without conversion.
+		 * @param image Image of the frame (after plane()).
+		 * @return True if the image is the luma.
+		 */
+		bool isLuma(const Mat &image) const
+		{
+			int resolved = resolve(image);
+			return image.type() == CV_8UC1 && (resolved == FORMAT_GRAY || resolved == FORMAT_NV12);
+		}
+
+		/**
+		 * Convert rows of the image to luma, until a row is available.
+		 * @param image Image of the frame (after plane()).
+		 * @param gray Luma being filled.
+		 * @param converted Number of rows already converted.
+		 * @param row Row needed.
+		 * @return Number of rows converted after the call.
+		 */
+		int convert(const Mat &image, Mat &gray, int converted, int row) const
+		{
+			switch(resolve(image))
+			{
+				case FORMAT_BGR:
+					return convertRows<ColorPixels<0, 2, 3> >(image, gray, converted, row);
+				case FORMAT_RGB:
+					return convertRows<ColorPixels<2, 0, 3> >(image, gray, converted, row);
+				case FORMAT_BGRA:
+					return convertRows<ColorPixels<0, 2, 4> >(image, gray, converted, row);
+				case FORMAT_RGBA:
+					return convertRows<ColorPixels<2, 0, 4> >(image, gray, converted, row);
+				case FORMAT_GRAY16:
+					return convertRows<WidePixels>(image, gray, converted, row);
+				case FORMAT_YUYV:
+					return convertRows<PackedPixels<0> >(image, gray, converted, row);
+				case FORMAT_UYVY:
+					return convertRows<PackedPixels<1> >(image, gray, converted, row);
+				case FORMAT_BAYER:
+					return convertRows<BayerPixels>(image, gray, converted, row);
+				default:
+					return image.rows;
+			}
+		}
+
+		/**
+		 * Check if the type of the image matches the format.
+		 * @param image Image of the frame (after plane()).
+		 * @return True if the image can be converted.
+		 */
+		bool supports(const Mat &image) const
+		{
+			switch(resolve(image))
+			{
+				case FORMAT_GRAY:
+				case FORMAT_NV12:
+				case FORMAT_BAYER:
+					return image.type() == CV_8UC1;
+				case FORMAT_BGR:
+				case FORMAT_RGB:
+					return image.type() == CV_8UC3;
+				case FORMAT_BGRA:
+				case FORMAT_RGBA:
+					return image.type() == CV_8UC4;
+				case FORMAT_GRAY16:
+					return image.type() == CV_16UC1;
+				case FORMAT_YUYV:
+				case FORMAT_UYVY:
+					return image.type() == CV_8UC2;
+				default:
+					return false;
+			}
+		}
+
+	private:
+		/**
+		 * Convert rows with a pixel accessor.
+		 */
+		template<class Pixels>
+		int convertRows(const Mat &image, Mat &gray, int converted, int row) const
+		{
+			while(converted <= row)
+			{
+				Pixels::row(image, converted, gray.ptr<uchar>(converted), depthShift);
+				converted++;
+			}
+
+			return converted;
+		}
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <vector>
+#include <math.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "math/Quadrilateral.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Uniform grid over the bounding boxes of a list of quads, used to find the quads that contain a point without testing all of them.
+ * Each quad is stored in all the cells covered by its bounding box, the cells are stored as a single flat list (offsets and items) so rebuilding the grid every frame does not allocate memory.
+ */
+class QuadGrid
+{
+	public:
+		/**
+		 * Size of the grid cells in pixels.
+		 */
+		int cellSize;
+
+		/**
+		 * Number of columns of the grid.
+		 */
+		int cols;
+
+		/**
+		 * Number of rows of the grid.
+		 */
+		int rows;
+
+		/**
+		 * Start of the items of each cell, the items of cell c are in [offsets[c], offsets[c + 1]).
+		 */
+		vector<int> offsets;
+
+		/**
+		 * Index of the quads stored in each cell.
+		 */
+		vector<int> items;
+
+		/**
+		 * Bounding box of each quad.
+		 */
+		vector<Rect> boxes;
+
+		/**
+		 * Area of each quad.
+		 */
+		vector<float> areas;
+
+		/**
+		 * Quad grid constructor.
+		 * @param _cellSize Size of the grid cells in pixels.
+		 */
+		QuadGrid(int _cellSize = 32)
+		{
+			cellSize = _cellSize;
+			cols = 0;
+			rows = 0;
+		}
+
+		/**
+		 * Build the grid for a list of quads.
+		 * @param quads Quads to store in the grid.
+		 * @param size Size of the image where the quads were found.
+		 */
+		void build(const vector<Quadrilateral> &quads, Size size)
+		{
+			cols = max((size.width + cellSize - 1) / cellSize, 1);
+			rows = max((size.height + cellSize - 1) / cellSize, 1);
+
+			boxes.resize(quads.size());
+			areas.resize(quads.size());
+			offsets.assign(cols * rows + 1, 0);
+
+			//Count the quads in each cell
+			for(unsigned int i = 0; i < quads.size(); i++)
+			{
+				boxes[i] = bounds(quads[i]);
+				areas[i] = area(quads[i]);
+
+				int x0, y0, x1, y1;
+				cellRange(boxes[i], x0, y0, x1, y1);
+
+				for(int y = y0; y <= y1; y++)
+				{
+					for(int x = x0; x <= x1; x++)
+					{
+						offsets[y * cols + x + 1]++;
+					}
+				}
+			}
+
+			for(int c = 0; c < cols * rows; c++)
+			{
+				offsets[c + 1] += offsets[c];
+			}
+
+			//Fill the cells, offsets are used as insertion cursors and restored after
+			items.resize(offsets[cols * rows]);
+
+			for(unsigned int i = 0; i < quads.size(); i++)
+			{
+				int x0, y0, x1, y1;
+				cellRange(boxes[i], x0, y0, x1, y1);
+
+				for(int y = y0; y <= y1; y++)
+				{
+					for(int x = x0; x <= x1; x++)
+					{
+						items[offsets[y * cols + x]++] = i;
+					}
+				}
+			}
+
+			for(int c = cols * rows; c > 0; c--)
+			{
+				offsets[c] = offsets[c - 1];
+			}
+			offsets[0] = 0;
+		}
+
+		/**
+		 * Find the smallest quad that contains the center of a quad and is larger than it.
+		 * Quads with the same area are ordered by index, so two equal quads never contain each other.
+		 * @param quads Quads used to build the grid.
+		 * @param index Index of the quad.
+		 * @return Index of the quad found, -1 if the center is not inside any other quad.
+		 */
+		int owner(vector<Quadrilateral> &quads, int index) const
+		{
+			const Quadrilateral &quad = quads[index];
+			Point2f center = (quad.points[0] + quad.points[1] + quad.points[2] + quad.points[3]) * 0.25f;
+
+			int x = min(max((int)center.x / cellSize, 0), cols - 1);
+			int y = min(max((int)center.y / cellSize, 0), rows - 1);
+			int cell = y * cols + x;
+
+			int found = -1;
+
+			for(int k = offsets[cell]; k < offsets[cell + 1]; k++)
+			{
+				int j = items[k];
+
+				if(j == index || !boxes[j].contains(Point((int)center.x, (int)center.y)))
+				{
+					continue;
+				}
+
+				if(areas[j] < areas[index] || (areas[j] == areas[index] && j > index))
+				{
+					continue;
+				}
+
+				if((found < 0 || areas[j] < areas[found]) && quads[j].containsPoint(center))
+				{
+					found = j;
+				}
+			}
+
+			return found;
+		}
+
+	private:
+		/**
+		 * Range of grid cells covered by a bounding box.
+		 */
+		void cellRange(const Rect &box, int &x0, int &y0, int &x1, int &y1) const
+		{
+			x0 = min(max(box.x / cellSize, 0), cols - 1);
+			y0 = min(max(box.y / cellSize, 0), rows - 1);
+			x1 = min(max((box.x + box.width - 1) / cellSize, 0), cols - 1);
+			y1 = min(max((box.y + box.height - 1) / cellSize, 0), rows - 1);
+		}
+
+		/**
+		 * Integer bounding box of a quad, including all the pixels touched by its corners.
+		 */
+		static Rect bounds(const Quadrilateral &quad)
+		{
+			float minX = quad.points[0].x, maxX = quad.points[0].x;
+			float minY = quad.points[0].y, maxY = quad.points[0].y;
+
+			for(int j = 1; j < 4; j++)
+			{
+				minX = min(minX, quad.points[j].x);
+				maxX = max(maxX, quad.points[j].x);
+				minY = min(minY, quad.points[j].y);
+				maxY = max(maxY, quad.points[j].y);
+			}
+
+			int x = (int)floor(minX);
+			int y = (int)floor(minY);
+
+			return Rect(x, y, (int)floor(maxX) - x + 1, (int)floor(maxY) - y + 1);
+		}
+
+		/**
+		 * Area of a quad (shoelace formula).
+		 */
+		static float area(const Quadrilateral &quad)
+		{
+			float sum = 0.0f;
+
+			for(int j = 0; j < 4; j++)
+			{
+				const Point2f &a = quad.points[j];
+				const Point2f &b = quad.points[(j + 1) % 4];
+				sum += a.x * b.y - b.x * a.y;
+			}
+
+			return fabs(sum) * 0.5f;
+		}
+};
@@ -1,16 +1,177 @@
 #pragma once
 
+#include <chrono>
+
 #include "math/Quadrilateral.cpp"
+#include "ThreadPool.cpp"
 
 using namespace cv;
 using namespace std;
 
+/**
+ * Number of contours rejected by each stage of the SquareFinder cascade.
+ * Stages run in the order of the fields, the cheaper tests first, so each contour is counted only in the stage that rejected it.
+ * Also keeps the time spent finding contours and filtering them, measured once per image (or tile) with the steady clock.
+ */
+class SquareFinderStats
+{
+	public:
+		/**
+		 * Contours tested.
+		 */
+		int contours;
+
+		/**
+		 * Contours with less than 4 points.
+		 */
+		int points;
+
+		/**
+		 * Contours too short to enclose a quad larger than the minimum area.
+		 */
+		int perimeter;
+
+		/**
+		 * Contours with a bounding box too small, too large or too elongated.
+		 */
+		int size;
+
+		/**
+		 * Contours that are not approximated by a polygon with 4 vertices.
+		 */
+		int polygon;
+
+		/**
+		 * Polygons smaller than the minimum area.
+		 */
+		int area;
+
+		/**
+		 * Polygons that are not convex.
+		 */
+		int convexity;
+
+		/**
+		 * Polygons with a corner too far from 90 degrees.
+		 */
+		int angle;
+
+		/**
+		 * Contours accepted as quads.
+		 */
+		int quads;
+
+		/**
+		 * Time spent in findContours in seconds, summed over the threads when the image is tiled.
+		 */
+		double contourTime;
+
+		/**
+		 * Time spent testing the contours in seconds, summed over the threads when the image is tiled.
+		 */
+		double quadTime;
+
+		/**
+		 * Square finder stats constructor, all counters start at zero.
+		 */
+		SquareFinderStats()
+		{
+			reset();
+		}
+
+		/**
+		 * Set all counters to zero.
+		 */
+		void reset()
+		{
+			contours = 0;
+			points = 0;
+			perimeter = 0;
+			size = 0;
+			polygon = 0;
+			area = 0;
+			convexity = 0;
+			angle = 0;
+			quads = 0;
+			contourTime = 0.0;
+			quadTime = 0.0;
+		}
+
+		/**
+		 * Add the counters of other stats to these.
+		 * @param other Stats to add.
+		 */
+		void add(const SquareFinderStats &other)
+		{
+			contours += other.contours;
+			points += other.points;
+			perimeter += other.perimeter;
+			size += other.size;
+			polygon += other.polygon;
+			area += other.area;
+			convexity += other.convexity;
+			angle += other.angle;
+			quads += other.quads;
+			contourTime += other.contourTime;
+			quadTime += other.quadTime;
+		}
+
+		/**
+		 * Print the counters to cout.
+		 */
+		void print()
+		{
+			cout << "SquareFinder" << endl;
+			cout << "    Contours: " << contours << endl;
+			cout << "    Points: " << points << endl;
+			cout << "    Perimeter: " << perimeter << endl;
+			cout << "    Size: " << size << endl;
+			cout << "    Polygon: " << polygon << endl;
+			cout << "    Area: " << area << endl;
+			cout << "    Convexity: " << convexity << endl;
+			cout << "    Angle: " << angle << endl;
+			cout << "    Quads: " << quads << endl;
+		}
+};
+
+/**
+ * Scratch buffers used by one thread to find quads.
+ */
+class ContourWorkspace
+{
+	public:
+		/**
+		 * Copy of the tile being processed.
+		 */
+		Mat tile;
+
+		/**
+		 * Contours found in the tile.
+		 */
+		vector<vector<Point>> contours;
+
+		/**
+		 * Polygon approximation of a contour.
+		 */
+		vector<Point> approx;
+
+		/**
+		 * Rejection counters of the contours processed by this workspace.
+		 */
+		SquareFinderStats stats;
+};
+
 /**
  * SquareFinder can be used to detect distorted squares in images.
  */
 class SquareFinder
 {
 	public:
+		/**
+		 * Maximum ratio between the sides of the bounding box of a quad candidate.
+		 */
+		static const int MAX_ASPECT = 10;
+
 		/**
 		 * Detect quads in grayscale image.
 		 * @param gray Grayscale image.
@@ -20,50 +181,281 @@ class SquareFinder
 		 */
 		static vector<Quadrilateral> findSquares(Mat gray, double limitCosine = 0.6, int minArea = 100, double maxError = 0.025)
 		{
-			//Quads found
-			vector<Quadrilateral> squares = vector<Quadrilateral>();
-
-			//Contours
+			vector<Quadrilateral> squares;
 			vector<vector<Point>> contours;
+			vector<Point> approx;
+
+			findSquares(gray, squares, contours, approx, limitCosine, minArea, maxError);
+
+			return squares;
+		}
+
+		/**
+		 * Detect quads in grayscale image using caller provided buffers.
+		 * The buffers keep their capacity, when reused across frames they grow to a high water mark and stop allocating.
+		 * @param gray Grayscale image.
+		 * @param squares Output vector, cleared before the quads are added.
+		 * @param contours Scratch buffer for the contours.
+		 * @param approx Scratch buffer for the polygon approximation.
+		 * @param limitCosine Limit value for cosine in the quad corners, by default its 0.6.
+		 * @param maxError Max error percentage relative to the square perimeter.
+		 * @param maxSize Maximum width and height of the contours bounding box, 0 for no limit.
+		 * @param stats Optional rejection counters, the contours of this image are added to them.
+		 */
+		static void findSquares(Mat gray, vector<Quadrilateral> &squares, vector<vector<Point>> &contours, vector<Point> &approx, double limitCosine = 0.6, int minArea = 100, double maxError = 0.025, int maxSize = 0, SquareFinderStats *stats = NULL)
+		{
+			squares.clear();
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
 			//Find contours and store them all as a list
 			findContours(gray, contours, RETR_LIST, CHAIN_APPROX_SIMPLE);
-			vector<Point> approx;
+
+			chrono::steady_clock::time_point found = chrono::steady_clock::now();
 
 			for(unsigned int i = 0; i < contours.size(); i++)
 			{
-				//Approximate contour with accuracy proportional to the contour perimeter
-				approxPolyDP(Mat(contours[i]), approx, arcLength(Mat(contours[i]), true) * maxError, true);
+				Quadrilateral quad;
+				if(contourToQuad(contours[i], approx, quad, limitCosine, minArea, maxError, maxSize, stats))
+				{
+					squares.push_back(quad);
+				}
+			}
+
+			if(stats != NULL)
+			{
+				stats->contourTime += chrono::duration<double>(found - start).count();
+				stats->quadTime += chrono::duration<double>(chrono::steady_clock::now() - found).count();
+			}
+		}
 
-				//Square contours have 4 vertices after approximation relatively large area (to filter out noisy contours)and be convex.
-				if(approx.size() == 4 && fabs(contourArea(Mat(approx))) > minArea && isContourConvex(Mat(approx)))
+		/**
+		 * Detect quads splitting the image in tiles processed in parallel.
+		 * Each tile is expanded by maxSize (right and bottom) so it fully contains every contour whose bounding box top left corner is inside the tile, that tile owns the contour.
+		 * Contours touching an inner edge of the expanded tile (possibly truncated) are discarded, they are always complete in the tile that owns them.
+		 * The quads found are the same as the ones found by findSquares() with the same maxSize, ordered by tile.
+		 * @param gray Grayscale image.
+		 * @param squares Output vector, cleared before the quads are added.
+		 * @param pool Thread pool used to process the tiles.
+		 * @param workspaces Scratch buffers for each thread of the pool.
+		 * @param tiles Scratch buffer with the quads found in each tile.
+		 * @param tileSize Size of the tiles.
+		 * @param maxSize Maximum width and height of the contours bounding box, has to be positive.
+		 * @param limitCosine Limit value for cosine in the quad corners.
+		 * @param minArea Minimum area of the quads.
+		 * @param maxError Max error percentage relative to the square perimeter.
+		 * @param stats Optional rejection counters, the contours of this image are added to them.
+		 */
+		static void findSquaresTiled(Mat gray, vector<Quadrilateral> &squares, ThreadPool &pool, vector<ContourWorkspace> &workspaces, vector<vector<Quadrilateral>> &tiles, int tileSize, int maxSize, double limitCosine = 0.6, int minArea = 100, double maxError = 0.025, SquareFinderStats *stats = NULL)
+		{
+			CV_Assert(tileSize > 0 && maxSize > 0);
+
+			int cols = (gray.cols + tileSize - 1) / tileSize;
+			int rows = (gray.rows + tileSize - 1) / tileSize;
+
+			if(workspaces.size() < pool.size())
+			{
+				workspaces.resize(pool.size());
+			}
+
+			for(unsigned int i = 0; i < workspaces.size(); i++)
+			{
+				workspaces[i].stats.reset();
+			}
+
+			tiles.resize(cols * rows);
+
+			pool.parallelFor(cols * rows, [&](int index, int worker)
+			{
+				ContourWorkspace &workspace = workspaces[worker];
+				vector<Quadrilateral> &found = tiles[index];
+				found.clear();
+
+				int tx = (index % cols) * tileSize;
+				int ty = (index / cols) * tileSize;
+
+				//Expanded tile, the extra pixels on the top and left are used to detect contours touching the edges
+				int x0 = max(tx - 2, 0);
+				int y0 = max(ty - 2, 0);
+				int x1 = min(tx + tileSize + maxSize + 2, gray.cols);
+				int y1 = min(ty + tileSize + maxSize + 2, gray.rows);
+
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+				//Tiles overlap and old versions of findContours modify the image, each tile is copied
+				gray(Rect(x0, y0, x1 - x0, y1 - y0)).copyTo(workspace.tile);
+				findContours(workspace.tile, workspace.contours, RETR_LIST, CHAIN_APPROX_SIMPLE);
+
+				chrono::steady_clock::time_point contoured = chrono::steady_clock::now();
+
+				for(unsigned int i = 0; i < workspace.contours.size(); i++)
 				{
-					float maxCosine = 0;
+					Rect box = boundingRect(workspace.contours[i]);
+
+					//Contour owned by other tile
+					if(box.x + x0 < tx || box.x + x0 >= tx + tileSize || box.y + y0 < ty || box.y + y0 >= ty + tileSize)
+					{
+						continue;
+					}
 
-					//Find the maximum cosine of the angle between joint edges
-					for(int j = 2; j < 5; j++)
+					//Contour touching an inner edge of the expanded tile
+					if((x0 > 0 && box.x <= 1) || (y0 > 0 && box.y <= 1) || (x1 < gray.cols && box.x + box.width >= x1 - x0 - 1) || (y1 < gray.rows && box.y + box.height >= y1 - y0 - 1))
 					{
-						float cosine = fabs(angleCornerPointsCos(approx[j%4], approx[j-2], approx[j-1]));
-						maxCosine = MAX(maxCosine, cosine);
+						continue;
 					}
 
-					//Check if all angle corner close to 90 (more than the max cosine)
-					if(maxCosine < limitCosine)
+					Quadrilateral quad;
+					if(contourToQuad(workspace.contours[i], workspace.approx, quad, limitCosine, minArea, maxError, maxSize, &workspace.stats))
 					{
-						Quadrilateral quad = Quadrilateral();
-						
-						for(int j = 0; !approx.empty() && j < 4; j++)
+						for(int j = 0; j < 4; j++)
 						{
-							quad.points[j] = approx.back();
-							approx.pop_back();
+							quad.points[j] += Point2f((float)x0, (float)y0);
 						}
 
-						squares.push_back(quad);
+						found.push_back(quad);
 					}
 				}
+
+				workspace.stats.contourTime += chrono::duration<double>(contoured - start).count();
+				workspace.stats.quadTime += chrono::duration<double>(chrono::steady_clock::now() - contoured).count();
+			});
+
+			squares.clear();
+			for(unsigned int i = 0; i < tiles.size(); i++)
+			{
+				squares.insert(squares.end(), tiles[i].begin(), tiles[i].end());
 			}
 
-			return squares;
+			if(stats != NULL)
+			{
+				for(unsigned int i = 0; i < workspaces.size(); i++)
+				{
+					stats->add(workspaces[i].stats);
+				}
+			}
+		}
+
+		/**
+		 * Check if a contour is a quad candidate.
+		 * Contours go through a cascade of tests, the cheap integer tests on the contour points run first so most noise blobs and edges are rejected before the polygon approximation:
+		 *  - The contour needs at least 4 points.
+		 *  - The contour length (L1, an upper bound of the perimeter of any polygon fitted to it) has to allow an area above minArea, a quad with perimeter P has area at most (P / 4)^2.
+		 *  - The bounding box has to be larger than minArea, smaller than maxSize and not too elongated (MAX_ASPECT).
+		 * The contour is then approximated by a polygon that has to have 4 vertices, the area, convexity and corner cosines of the polygon are computed in a single pass.
+		 * @param contour Contour to check.
+		 * @param approx Scratch buffer for the polygon approximation.
+		 * @param quad Output quad.
+		 * @param limitCosine Limit value for cosine in the quad corners.
+		 * @param minArea Minimum area of the quad.
+		 * @param maxError Max error percentage relative to the contour perimeter.
+		 * @param maxSize Maximum width and height of the contour bounding box, 0 for no limit.
+		 * @param stats Optional rejection counters.
+		 * @return True if the contour is a quad candidate.
+		 */
+		static bool contourToQuad(const vector<Point> &contour, vector<Point> &approx, Quadrilateral &quad, double limitCosine, int minArea, double maxError, int maxSize = 0, SquareFinderStats *stats = NULL)
+		{
+			SquareFinderStats ignored;
+			SquareFinderStats &counters = stats != NULL ? *stats : ignored;
+
+			counters.contours++;
+
+			int count = contour.size();
+			if(count < 4)
+			{
+				counters.points++;
+				return false;
+			}
+
+			//Bounding box and L1 length in a single pass over the points
+			int minX = contour[0].x, maxX = minX;
+			int minY = contour[0].y, maxY = minY;
+			long length = 0;
+
+			for(int i = 0; i < count; i++)
+			{
+				const Point &p = contour[i];
+				const Point &n = contour[i + 1 < count ? i + 1 : 0];
+
+				length += abs(n.x - p.x) + abs(n.y - p.y);
+				minX = min(minX, p.x);
+				maxX = max(maxX, p.x);
+				minY = min(minY, p.y);
+				maxY = max(maxY, p.y);
+			}
+
+			if(length * length <= 16L * minArea)
+			{
+				counters.perimeter++;
+				return false;
+			}
+
+			long width = maxX - minX + 1;
+			long height = maxY - minY + 1;
+
+			if(width * height <= minArea || (maxSize > 0 && (width > maxSize || height > maxSize)) || width > height * MAX_ASPECT || height > width * MAX_ASPECT)
+			{
+				counters.size++;
+				return false;
+			}
+
+			//Approximate contour with accuracy proportional to the contour perimeter
+			approxPolyDP(contour, approx, arcLength(contour, true) * maxError, true);
+
+			if(approx.size() != 4)
+			{
+				counters.polygon++;
+				return false;
+			}
+
+			//Area, convexity and corner cosines of the polygon
+			long doubleArea = 0;
+			int orientation = 0;
+			float maxCosine = 0.0f;
+
+			for(int j = 0; j < 4; j++)
+			{
+				const Point &a = approx[j];
+				const Point &b = approx[(j + 1) % 4];
+				const Point &c = approx[(j + 2) % 4];
+
+				doubleArea += (long)a.x * b.y - (long)b.x * a.y;
+
+				//Corner b, between the edges a -> b and b -> c
+				long dx1 = a.x - b.x, dy1 = a.y - b.y;
+				long dx2 = c.x - b.x, dy2 = c.y - b.y;
+				long cross = dx2 * dy1 - dx1 * dy2;
+				orientation |= cross > 0 ? 1 : 2;
+
+				float cosine = fabs((dx1 * dx2 + dy1 * dy2) / sqrt((double)(dx1 * dx1 + dy1 * dy1) * (dx2 * dx2 + dy2 * dy2) + 1e-12));
+				maxCosine = max(maxCosine, cosine);
+			}
+
+			if(labs(doubleArea) <= 2L * minArea)
+			{
+				counters.area++;
+				return false;
+			}
+
+			if(orientation == 3)
+			{
+				counters.convexity++;
+				return false;
+			}
+
+			//Check if all angle corner close to 90 (more than the max cosine)
+			if(maxCosine >= limitCosine)
+			{
+				counters.angle++;
+				return false;
+			}
+
+			for(int j = 0; j < 4; j++)
+			{
+				quad.points[j] = approx[3 - j];
+			}
+
+			counters.quads++;
+			return true;
 		}
 
 		/**
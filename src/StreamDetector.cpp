@@ -0,0 +1,1118 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <math.h>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "ArucoDetector.cpp"
+#include "ThreadPool.cpp"
+#include "FairScheduler.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * What to do when an item is pushed into a full queue.
+ */
+enum DropPolicy
+{
+	/**
+	 * Drop the oldest item in the queue, the latest frame always gets in (default).
+	 */
+	DROP_OLDEST = 0,
+
+	/**
+	 * Drop the item being pushed.
+	 */
+	DROP_NEWEST = 1,
+
+	/**
+	 * Wait until there is space in the queue, nothing is dropped (the producer sleeps until a consumer pops an item).
+	 */
+	DROP_NONE = 2
+};
+
+/**
+ * Bounded multi producer multi consumer lock-free queue (Vyukov's algorithm).
+ * Each slot has a sequence number that tells if it is free for the producer of a position or full for the consumer of that position.
+ * Consumers can wait for items and producers for space, the waits use a mutex only when the queue is empty (or full) so pushing and popping never lock.
+ * A thread that waits registers itself in a counter and then checks the queue again, the other side publishes its slot and then reads the counter.
+ * Both sides put a sequentially consistent fence between the two steps, so either the waiter sees the slot or the other side sees the waiter and wakes it.
+ */
+template<typename T>
+class BoundedQueue
+{
+	public:
+		/**
+		 * Create a queue.
+		 * The sequence numbers can not tell a full slot from a free one with a single slot, the capacity is at least 2.
+		 * @param _capacity Maximum number of items in the queue.
+		 */
+		BoundedQueue(unsigned int _capacity) : capacity(max(_capacity, 2u)), slots(new Slot[max(_capacity, 2u)])
+		{
+			for(size_t i = 0; i < capacity; i++)
+			{
+				slots[i].sequence.store(i, memory_order_relaxed);
+			}
+
+			head.store(0, memory_order_relaxed);
+			tail.store(0, memory_order_relaxed);
+			waiting.store(0);
+			blocked.store(0);
+		}
+
+		/**
+		 * Try to add an item to the queue, the item is moved only on success.
+		 * @param value Item to add.
+		 * @return True if the item was added, false if the queue is full.
+		 */
+		bool tryPush(T &value)
+		{
+			size_t position = tail.load(memory_order_relaxed);
+			Slot *slot;
+
+			while(true)
+			{
+				slot = &slots[position % capacity];
+				size_t sequence = slot->sequence.load(memory_order_acquire);
+				intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+				if(difference == 0)
+				{
+					if(tail.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+					{
+						break;
+					}
+				}
+				else if(difference < 0)
+				{
+					return false;
+				}
+				else
+				{
+					position = tail.load(memory_order_relaxed);
+				}
+			}
+
+			slot->value = move(value);
+			slot->sequence.store(position + 1, memory_order_release);
+
+			//Orders the slot store before the waiting load (a consumer registers before checking the slot)
+			atomic_thread_fence(memory_order_seq_cst);
+
+			if(waiting.load(memory_order_relaxed) > 0)
+			{
+				lock_guard<mutex> lock(waitMutex);
+				waitCondition.notify_all();
+			}
+
+			return true;
+		}
+
+		/**
+		 * Try to remove the oldest item from the queue.
+		 * @param value Item removed.
+		 * @return True if an item was removed, false if the queue is empty.
+		 */
+		bool tryPop(T &value)
+		{
+			size_t position = head.load(memory_order_relaxed);
+			Slot *slot;
+
+			while(true)
+			{
+				slot = &slots[position % capacity];
+				size_t sequence = slot->sequence.load(memory_order_acquire);
+				intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+				if(difference == 0)
+				{
+					if(head.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+					{
+						break;
+					}
+				}
+				else if(difference < 0)
+				{
+					return false;
+				}
+				else
+				{
+					position = head.load(memory_order_relaxed);
+				}
+			}
+
+			value = move(slot->value);
+			slot->value = T();
+			slot->sequence.store(position + capacity, memory_order_release);
+
+			//Orders the slot store before the blocked load (a producer registers before checking the slot)
+			atomic_thread_fence(memory_order_seq_cst);
+
+			if(blocked.load(memory_order_relaxed) > 0)
+			{
+				lock_guard<mutex> lock(spaceMutex);
+				spaceCondition.notify_all();
+			}
+
+			return true;
+		}
+
+		/**
+		 * Remove the oldest item, waiting until an item is available or the running flag is cleared.
+		 * @param value Item removed.
+		 * @param running Flag checked while waiting.
+		 * @return True if an item was removed.
+		 */
+		bool pop(T &value, const atomic<bool> &running)
+		{
+			while(!tryPop(value))
+			{
+				if(!running.load())
+				{
+					return false;
+				}
+
+				//Items are popped outside of the lock, tryPop takes the space lock to wake producers
+				unique_lock<mutex> lock(waitMutex);
+				waiting++;
+				atomic_thread_fence(memory_order_seq_cst);
+
+				while(running.load() && !readable())
+				{
+					waitCondition.wait(lock);
+				}
+
+				waiting--;
+			}
+
+			return true;
+		}
+
+		/**
+		 * Add an item, waiting until there is space in the queue or the running flag is cleared.
+		 * @param value Item to add, moved only on success.
+		 * @param running Flag checked while waiting.
+		 * @return True if the item was added.
+		 */
+		bool push(T &value, const atomic<bool> &running)
+		{
+			while(!tryPush(value))
+			{
+				if(!running.load())
+				{
+					return false;
+				}
+
+				unique_lock<mutex> lock(spaceMutex);
+				blocked++;
+				atomic_thread_fence(memory_order_seq_cst);
+
+				while(running.load() && !writable())
+				{
+					spaceCondition.wait(lock);
+				}
+
+				blocked--;
+			}
+
+			return true;
+		}
+
+		/**
+		 * Wake up all the threads waiting for items or space (e.g. when stopping).
+		 */
+		void wake()
+		{
+			{
+				lock_guard<mutex> lock(waitMutex);
+				waitCondition.notify_all();
+			}
+
+			lock_guard<mutex> lock(spaceMutex);
+			spaceCondition.notify_all();
+		}
+
+	private:
+		/**
+		 * Check if the item at the head is ready to be popped, without popping it.
+		 */
+		bool readable() const
+		{
+			size_t position = head.load(memory_order_relaxed);
+			return slots[position % capacity].sequence.load(memory_order_acquire) == position + 1;
+		}
+
+		/**
+		 * Check if the slot at the tail is free to be pushed, without pushing.
+		 */
+		bool writable() const
+		{
+			size_t position = tail.load(memory_order_relaxed);
+			return slots[position % capacity].sequence.load(memory_order_acquire) == position;
+		}
+
+		/**
+		 * Queue position with its sequence number.
+		 */
+		struct Slot
+		{
+			atomic<size_t> sequence;
+			T value;
+		};
+
+		/**
+		 * Number of slots.
+		 */
+		const size_t capacity;
+
+		/**
+		 * Slots of the queue.
+		 */
+		unique_ptr<Slot[]> slots;
+
+		/**
+		 * Next position to pop.
+		 */
+		atomic<size_t> head;
+
+		/**
+		 * Keeps the head and the tail in different cache lines, producers and consumers don't invalidate each other.
+		 */
+		char padding[64];
+
+		/**
+		 * Next position to push.
+		 */
+		atomic<size_t> tail;
+
+		/**
+		 * Number of consumers waiting for items.
+		 */
+		atomic<int> waiting;
+
+		/**
+		 * Mutex used only to sleep while the queue is empty.
+		 */
+		mutex waitMutex;
+
+		/**
+		 * Signals waiting consumers when items are pushed.
+		 */
+		condition_variable waitCondition;
+
+		/**
+		 * Number of producers waiting for space.
+		 */
+		atomic<int> blocked;
+
+		/**
+		 * Mutex used only to sleep while the queue is full.
+		 */
+		mutex spaceMutex;
+
+		/**
+		 * Signals waiting producers when items are popped.
+		 */
+		condition_variable spaceCondition;
+};
+
+/**
+ * Histogram of latencies with logarithmic buckets (4 per power of two microseconds, up to about 70 seconds).
+ * Can be updated and read from different threads.
+ */
+class LatencyHistogram
+{
+	public:
+		/**
+		 * Number of buckets.
+		 */
+		static const int BUCKETS = 104;
+
+		/**
+		 * Histogram constructor.
+		 */
+		LatencyHistogram()
+		{
+			reset();
+		}
+
+		/**
+		 * Clear the histogram.
+		 */
+		void reset()
+		{
+			for(int i = 0; i < BUCKETS; i++)
+			{
+				counts[i].store(0);
+			}
+
+			total.store(0);
+		}
+
+		/**
+		 * Add a latency.
+		 * @param seconds Latency in seconds.
+		 */
+		void add(double seconds)
+		{
+			counts[bucket(seconds)]++;
+			total++;
+		}
+
+		/**
+		 * Number of latencies added.
+		 * @return Number of latencies.
+		 */
+		unsigned long count() const
+		{
+			return total.load();
+		}
+
+		/**
+		 * Get a percentile of the latencies, the result is the upper limit of the bucket (at most 19% above the real value).
+		 * @param percentile Percentile between 0 and 100.
+		 * @return Latency in seconds, 0 if the histogram is empty.
+		 */
+		double percentile(double percentile) const
+		{
+			unsigned long size = total.load();
+			if(size == 0)
+			{
+				return 0.0;
+			}
+
+			unsigned long target = (unsigned long)ceil(size * percentile / 100.0);
+			unsigned long sum = 0;
+
+			for(int i = 0; i < BUCKETS; i++)
+			{
+				sum += counts[i].load();
+				if(sum >= max(target, 1ul))
+				{
+					return limit(i);
+				}
+			}
+
+			return limit(BUCKETS - 1);
+		}
+
+		/**
+		 * Get the bucket of a latency.
+		 * @param seconds Latency in seconds.
+		 * @return Index of the bucket.
+		 */
+		static int bucket(double seconds)
+		{
+			double micro = max(seconds * 1e6, 1.0);
+			return min((int)(log2(micro) * 4.0), BUCKETS - 1);
+		}
+
+		/**
+		 * Get the upper limit of a bucket.
+		 * @param bucket Index of the bucket.
+		 * @return Latency in seconds.
+		 */
+		static double limit(int bucket)
+		{
+			return pow(2.0, (bucket + 1) / 4.0) * 1e-6;
+		}
+
+	private:
+		/**
+		 * Number of latencies in each bucket.
+		 */
+		atomic<unsigned long> counts[BUCKETS];
+
+		/**
+		 * Number of latencies added.
+		 */
+		atomic<unsigned long> total;
+};
+
+/**
+ * Histogram of the latencies of a recent time window, with the same buckets as the LatencyHistogram.
+ * Latencies are kept in two halves of the window, when the current half is older than half of the window the older half is cleared and reused.
+ * The percentiles cover between half and the full window of latencies. Not thread safe, has to be used from a single thread.
+ */
+class RollingHistogram
+{
+	public:
+		/**
+		 * Duration of the window in seconds, by default 10 seconds.
+		 */
+		double window;
+
+		/**
+		 * Rolling histogram constructor.
+		 * @param _window Duration of the window in seconds.
+		 */
+		RollingHistogram(double _window = 10.0)
+		{
+			window = _window;
+			current = 0;
+			reset();
+		}
+
+		/**
+		 * Clear the histogram.
+		 */
+		void reset()
+		{
+			for(int i = 0; i < LatencyHistogram::BUCKETS; i++)
+			{
+				counts[0][i] = 0;
+				counts[1][i] = 0;
+			}
+
+			totals[0] = 0;
+			totals[1] = 0;
+			started = chrono::steady_clock::now();
+		}
+
+		/**
+		 * Add a latency.
+		 * @param seconds Latency in seconds.
+		 * @param now Current time, used to move the window.
+		 */
+		void add(double seconds, chrono::steady_clock::time_point now = chrono::steady_clock::now())
+		{
+			if(chrono::duration<double>(now - started).count() >= window / 2.0)
+			{
+				current = 1 - current;
+				started = now;
+
+				for(int i = 0; i < LatencyHistogram::BUCKETS; i++)
+				{
+					counts[current][i] = 0;
+				}
+
+				totals[current] = 0;
+			}
+
+			counts[current][LatencyHistogram::bucket(seconds)]++;
+			totals[current]++;
+		}
+
+		/**
+		 * Number of latencies in the window.
+		 * @return Number of latencies.
+		 */
+		unsigned long count() const
+		{
+			return totals[0] + totals[1];
+		}
+
+		/**
+		 * Get a percentile of the latencies in the window, the result is the upper limit of the bucket.
+		 * @param percentile Percentile between 0 and 100.
+		 * @return Latency in seconds, 0 if the window is empty.
+		 */
+		double percentile(double percentile) const
+		{
+			unsigned long size = count();
+			if(size == 0)
+			{
+				return 0.0;
+			}
+
+			unsigned long target = max((unsigned long)ceil(size * percentile / 100.0), 1ul);
+			unsigned long sum = 0;
+
+			for(int i = 0; i < LatencyHistogram::BUCKETS; i++)
+			{
+				sum += counts[0][i] + counts[1][i];
+				if(sum >= target)
+				{
+					return LatencyHistogram::limit(i);
+				}
+			}
+
+			return LatencyHistogram::limit(LatencyHistogram::BUCKETS - 1);
+		}
+
+	private:
+		/**
+		 * Number of latencies in each bucket of each half of the window.
+		 */
+		unsigned long counts[2][LatencyHistogram::BUCKETS];
+
+		/**
+		 * Number of latencies in each half of the window.
+		 */
+		unsigned long totals[2];
+
+		/**
+		 * Half of the window being filled.
+		 */
+		int current;
+
+		/**
+		 * Time when the current half was started.
+		 */
+		chrono::steady_clock::time_point started;
+};
+
+/**
+ * Result of a frame processed by the stream detector.
+ */
+class StreamResult
+{
+	public:
+		/**
+		 * Sequence number of the frame (order of submission).
+		 */
+		unsigned long sequence;
+
+		/**
+		 * Capture time of the frame in nanoseconds, as given when submitted (kept as an integer so the stamp of the source image is returned unchanged).
+		 */
+		int64_t timestamp;
+
+		/**
+		 * Set when the frame was dropped because a stage fell behind, the other fields are not filled.
+		 */
+		bool dropped;
+
+		/**
+		 * Frame submitted.
+		 */
+		Mat frame;
+
+		/**
+		 * Pixel format of the frame.
+		 */
+		PixelFormat format;
+
+		/**
+		 * Owner of the frame data when the frame references external memory (e.g. an image message), released with the result.
+		 */
+		shared_ptr<const void> owner;
+
+		/**
+		 * Markers found in the frame.
+		 */
+		vector<ArucoMarker> markers;
+
+		/**
+		 * Time spent in each detection stage.
+		 */
+		FrameTimings timings;
+
+		/**
+		 * Time spent by the caller to get the frame (e.g. decoding a message) in seconds, as given when submitted.
+		 */
+		double conversion;
+
+		/**
+		 * Number of contours tested and of quads decoded.
+		 */
+		int contours;
+		int candidates;
+
+		/**
+		 * Rotation of the camera (Rodrigues), set by the pose function if any.
+		 */
+		Mat rotation;
+
+		/**
+		 * Position of the camera, set by the pose function if any.
+		 */
+		Mat position;
+
+		/**
+		 * Stream result constructor.
+		 */
+		StreamResult()
+		{
+			sequence = 0;
+			timestamp = 0;
+			dropped = false;
+			conversion = 0.0;
+			contours = 0;
+			candidates = 0;
+		}
+};
+
+/**
+ * Detects markers in a stream of frames using a pipeline of stages, each running in its own thread.
+ * The stages (preprocess, quad search, decode and pose) are connected by bounded lock-free queues, while one frame is being decoded the next ones are already being thresholded and searched.
+ *
+ * When a stage falls behind its input queue fills up and the drop policy of the queue is applied, by default the oldest frame is dropped so the latest frame always gets processed and the latency stays bounded.
+ * Results are delivered through the future returned by submit() and the callback, both in the pose stage thread.
+ * Each frame in flight uses its own ArucoDetector (created from the settings detector and reused), tracking is not supported in the stream detector.
+ */
+class StreamDetector
+{
+	public:
+		/**
+		 * Stages of the pipeline.
+		 */
+		enum Stage
+		{
+			STAGE_PREPROCESS = 0,
+			STAGE_QUADS = 1,
+			STAGE_DECODE = 2,
+			STAGE_POSE = 3,
+			STAGES = 4
+		};
+
+		/**
+		 * Detector used as template for the detectors of the frames in flight, has to be configured before start().
+		 */
+		ArucoDetector settings;
+
+		/**
+		 * Pose function, called in the pose stage with the markers of each frame.
+		 * Can set the rotation and position of the result.
+		 */
+		function<void(StreamResult&)> pose;
+
+		/**
+		 * Callback called with the result of each processed frame after the pose stage.
+		 */
+		function<void(StreamResult&)> callback;
+
+		/**
+		 * Callback called with the frame and the error message when a stage throws (e.g. a frame in an unsupported pixel format).
+		 * The future of the frame gets the exception and the frame is not passed to the next stages.
+		 */
+		function<void(const StreamResult&, const string&)> error;
+
+		/**
+		 * Scheduler shared with other cameras, each detection stage holds a slot while it processes a frame (NULL for no limit).
+		 */
+		shared_ptr<FairScheduler> scheduler;
+
+		/**
+		 * Capacity of the input queue of each stage, by default 2 (also the minimum).
+		 */
+		unsigned int capacities[STAGES];
+
+		/**
+		 * Drop policy of the input queue of each stage, by default DROP_OLDEST.
+		 */
+		int policies[STAGES];
+
+		/**
+		 * Latency from the submission of the frame to the end of each stage, the last stage is the end to end latency.
+		 */
+		LatencyHistogram latency[STAGES];
+
+		/**
+		 * Number of frames dropped at the input of each stage.
+		 */
+		atomic<unsigned long> dropped[STAGES];
+
+		/**
+		 * Number of frames submitted.
+		 */
+		atomic<unsigned long> submitted;
+
+		/**
+		 * Number of frames that completed all the stages.
+		 */
+		atomic<unsigned long> completed;
+
+		/**
+		 * Number of frames where a stage threw an exception.
+		 */
+		atomic<unsigned long> failed;
+
+		/**
+		 * Stream detector constructor, stages are not started.
+		 */
+		StreamDetector()
+		{
+			for(int i = 0; i < STAGES; i++)
+			{
+				capacities[i] = 2;
+				policies[i] = DROP_OLDEST;
+				dropped[i].store(0);
+			}
+
+			submitted.store(0);
+			completed.store(0);
+			failed.store(0);
+			running.store(false);
+		}
+
+		/**
+		 * Stops the stages.
+		 */
+		~StreamDetector()
+		{
+			stop();
+		}
+
+		/**
+		 * Create the queues and start the stage threads.
+		 */
+		void start()
+		{
+			if(running.load())
+			{
+				return;
+			}
+
+			unsigned int slots = 1;
+			for(int i = 0; i < STAGES; i++)
+			{
+				queues[i].reset(new BoundedQueue<shared_ptr<Packet>>(capacities[i]));
+				slots += capacities[i] + 1;
+			}
+
+			detectors.reset(new BoundedQueue<shared_ptr<ArucoDetector>>(slots));
+
+			//The pool of the settings is shared with other detectors (e.g. other cameras), otherwise a pool is created for the stream
+			if(settings.pool)
+			{
+				pool = settings.pool;
+			}
+			else if(settings.threads > 1)
+			{
+				pool = make_shared<ThreadPool>(settings.threads);
+			}
+
+			running.store(true);
+
+			for(int i = 0; i < STAGES; i++)
+			{
+				threads.push_back(thread(&StreamDetector::work, this, i));
+			}
+		}
+
+		/**
+		 * Stop the stage threads, frames still in the queues are resolved as dropped.
+		 */
+		void stop()
+		{
+			if(!running.load())
+			{
+				return;
+			}
+
+			running.store(false);
+
+			for(int i = 0; i < STAGES; i++)
+			{
+				queues[i]->wake();
+			}
+
+			for(unsigned int i = 0; i < threads.size(); i++)
+			{
+				threads[i].join();
+			}
+
+			threads.clear();
+
+			for(int i = 0; i < STAGES; i++)
+			{
+				shared_ptr<Packet> packet;
+				while(queues[i]->tryPop(packet))
+				{
+					drop(packet, i);
+				}
+			}
+		}
+
+		/**
+		 * Submit a frame to the pipeline, returns immediately.
+		 * The frame data is referenced (not copied) until the frame is processed, the caller should not modify it.
+		 * @param frame Frame to process.
+		 * @param timestamp Capture time of the frame in nanoseconds.
+		 * @param owner Owner of the frame data, kept alive until the frame is processed or dropped.
+		 * @return Future with the result, resolved with dropped set if the frame is dropped.
+		 */
+		future<StreamResult> submit(Mat frame, int64_t timestamp = 0, shared_ptr<const void> owner = shared_ptr<const void>())
+		{
+			return submit(frame, timestamp, owner, settings.pixelFormat);
+		}
+
+		/**
+		 * Submit a frame in a pixel format different from the settings (e.g. when the format of each frame is only known when it arrives).
+		 * @param frame Frame to process.
+		 * @param timestamp Capture time of the frame in nanoseconds.
+		 * @param owner Owner of the frame data, kept alive until the frame is processed or dropped.
+		 * @param format Pixel format of the frame.
+		 * @param conversion Time spent to get the frame in seconds, returned in the result.
+		 * @return Future with the result, resolved with dropped set if the frame is dropped.
+		 */
+		future<StreamResult> submit(Mat frame, int64_t timestamp, shared_ptr<const void> owner, const PixelFormat &format, double conversion = 0.0)
+		{
+			CV_Assert(running.load());
+
+			shared_ptr<Packet> packet = make_shared<Packet>();
+			packet->result.sequence = submitted++;
+			packet->result.timestamp = timestamp;
+			packet->result.frame = frame;
+			packet->result.format = format;
+			packet->result.owner = owner;
+			packet->result.conversion = conversion;
+			packet->submitted = chrono::steady_clock::now();
+
+			future<StreamResult> result = packet->output.get_future();
+
+			forward(packet, STAGE_PREPROCESS);
+
+			return result;
+		}
+
+	private:
+		/**
+		 * Frame in flight.
+		 */
+		struct Packet
+		{
+			StreamResult result;
+			shared_ptr<ArucoDetector> detector;
+			promise<StreamResult> output;
+			chrono::steady_clock::time_point submitted;
+		};
+
+		/**
+		 * Input queue of each stage.
+		 */
+		unique_ptr<BoundedQueue<shared_ptr<Packet>>> queues[STAGES];
+
+		/**
+		 * Detectors not being used by any frame.
+		 */
+		unique_ptr<BoundedQueue<shared_ptr<ArucoDetector>>> detectors;
+
+		/**
+		 * Thread pool shared by the detectors, the pool of the settings or a pool created when the settings use more than one thread.
+		 */
+		shared_ptr<ThreadPool> pool;
+
+		/**
+		 * Stage threads.
+		 */
+		vector<thread> threads;
+
+		/**
+		 * Flag cleared to stop the stages.
+		 */
+		atomic<bool> running;
+
+		/**
+		 * Push a packet into the input queue of a stage applying its drop policy.
+		 * @param packet Packet to push.
+		 * @param stage Stage that receives the packet.
+		 */
+		void forward(shared_ptr<Packet> &packet, int stage)
+		{
+			BoundedQueue<shared_ptr<Packet>> &queue = *queues[stage];
+
+			//Sleeps until the stage pops a packet, the packet is only dropped when stopping
+			if(policies[stage] == DROP_NONE)
+			{
+				if(!queue.push(packet, running))
+				{
+					drop(packet, stage);
+				}
+
+				return;
+			}
+
+			while(!queue.tryPush(packet))
+			{
+				if(policies[stage] == DROP_NEWEST || !running.load())
+				{
+					drop(packet, stage);
+					return;
+				}
+
+				shared_ptr<Packet> oldest;
+				if(queue.tryPop(oldest))
+				{
+					drop(oldest, stage);
+				}
+			}
+		}
+
+		/**
+		 * Resolve a packet as dropped and release its detector.
+		 * @param packet Packet dropped.
+		 * @param stage Stage where the packet was dropped.
+		 */
+		void drop(shared_ptr<Packet> &packet, int stage)
+		{
+			dropped[stage]++;
+			release(packet);
+
+			StreamResult result;
+			result.sequence = packet->result.sequence;
+			result.timestamp = packet->result.timestamp;
+			result.dropped = true;
+
+			packet->output.set_value(result);
+		}
+
+		/**
+		 * Return the detector of a packet to the free detectors.
+		 * @param packet Packet that owns the detector.
+		 */
+		void release(shared_ptr<Packet> &packet)
+		{
+			if(packet->detector)
+			{
+				detectors->tryPush(packet->detector);
+				packet->detector.reset();
+			}
+		}
+
+		/**
+		 * Get a detector for a new frame, reused from previous frames when possible.
+		 * @return Detector.
+		 */
+		shared_ptr<ArucoDetector> acquire()
+		{
+			shared_ptr<ArucoDetector> detector;
+
+			if(!detectors->tryPop(detector))
+			{
+				detector = make_shared<ArucoDetector>(settings);
+				detector->tracking = false;
+
+				if(pool)
+				{
+					detector->setThreadPool(pool);
+				}
+			}
+
+			return detector;
+		}
+
+		/**
+		 * Stage thread loop.
+		 * @param stage Stage run by the thread.
+		 */
+		void work(int stage)
+		{
+			shared_ptr<Packet> packet;
+
+			while(queues[stage]->pop(packet, running))
+			{
+				bool processed;
+
+				//The pose stage is not limited, it only waits for the calibration lock
+				{
+					FairScheduler::Slot slot(stage < STAGE_POSE ? scheduler.get() : NULL);
+					processed = run(packet, stage);
+				}
+
+				latency[stage].add(chrono::duration<double>(chrono::steady_clock::now() - packet->submitted).count());
+
+				if(processed && stage + 1 < STAGES)
+				{
+					forward(packet, stage + 1);
+				}
+
+				packet.reset();
+			}
+		}
+
+		/**
+		 * Run a stage for a packet.
+		 * Exceptions thrown by the stage are delivered through the future of the frame, the detector of the frame is returned to the free detectors.
+		 * @param packet Packet to process.
+		 * @param stage Stage to run.
+		 * @return False if the stage failed, the packet is resolved and cannot be forwarded.
+		 */
+		bool run(shared_ptr<Packet> &packet, int stage)
+		{
+			try
+			{
+				process(packet, stage);
+				return true;
+			}
+			catch(const exception &e)
+			{
+				fail(packet, e.what());
+			}
+			catch(...)
+			{
+				fail(packet, "unknown error");
+			}
+
+			return false;
+		}
+
+		/**
+		 * Resolve a packet with the exception being handled and release its detector.
+		 * Has to be called from a catch block.
+		 * @param packet Packet that failed.
+		 * @param message Error message.
+		 */
+		void fail(shared_ptr<Packet> &packet, const string &message)
+		{
+			failed++;
+			release(packet);
+
+			if(error)
+			{
+				error(packet->result, message);
+			}
+
+			packet->output.set_exception(current_exception());
+		}
+
+		/**
+		 * Process a stage for a packet.
+		 * @param packet Packet to process.
+		 * @param stage Stage to run.
+		 */
+		void process(shared_ptr<Packet> &packet, int stage)
+		{
+			if(stage == STAGE_PREPROCESS)
+			{
+				packet->detector = acquire();
+				packet->detector->pixelFormat = packet->result.format;
+				packet->detector->preprocess(packet->result.frame);
+			}
+			else if(stage == STAGE_QUADS)
+			{
+				packet->detector->searchQuads();
+			}
+			else if(stage == STAGE_DECODE)
+			{
+				ArucoDetector &detector = *packet->detector;
+				detector.decode(detector.context.gray);
+				detector.context.track();
+
+				packet->result.markers = detector.context.markers;
+				packet->result.timings = detector.context.timings;
+				packet->result.contours = detector.context.squareStats.contours;
+				packet->result.candidates = detector.context.quads.size();
+				release(packet);
+			}
+			else
+			{
+				if(pose)
+				{
+					pose(packet->result);
+				}
+
+				if(callback)
+				{
+					callback(packet->result);
+				}
+
+				completed++;
+				packet->output.set_value(packet->result);
+			}
+		}
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+/**
+ * Fixed size pool of worker threads.
+ * Used to run the detection stages in parallel, the pool can be shared by multiple detectors.
+ */
+class ThreadPool
+{
+	public:
+		/**
+		 * Create a thread pool.
+		 * The thread calling parallelFor also does work, so a pool of size N creates N - 1 worker threads.
+		 * @param threads Number of threads, if 0 the number of hardware threads is used.
+		 */
+		ThreadPool(unsigned int threads = 0)
+		{
+			if(threads == 0)
+			{
+				threads = thread::hardware_concurrency();
+			}
+
+			running = true;
+
+			for(unsigned int i = 1; i < threads; i++)
+			{
+				workers.push_back(thread(&ThreadPool::work, this));
+			}
+		}
+
+		/**
+		 * Stops the workers, tasks still in the queue are executed before the threads exit.
+		 */
+		~ThreadPool()
+		{
+			{
+				unique_lock<mutex> lock(queueMutex);
+				running = false;
+			}
+
+			queueCondition.notify_all();
+
+			for(unsigned int i = 0; i < workers.size(); i++)
+			{
+				workers[i].join();
+			}
+		}
+
+		/**
+		 * Number of threads that can run work simultaneously, including the calling thread.
+		 * @return Number of threads.
+		 */
+		unsigned int size() const
+		{
+			return workers.size() + 1;
+		}
+
+		/**
+		 * Add a task to be executed by one of the workers.
+		 * @param task Task to run.
+		 */
+		void submit(function<void()> task)
+		{
+			{
+				unique_lock<mutex> lock(queueMutex);
+				tasks.push_back(task);
+			}
+
+			queueCondition.notify_one();
+		}
+
+		/**
+		 * Run body for every index in [0, count) and wait for all of them to finish.
+		 * Indexes are distributed dynamically, each thread grabs the next index when it is free.
+		 * The calling thread also runs indexes, so the call completes even when all the workers are busy.
+		 * @param count Number of indexes.
+		 * @param body Function called with the index and the id (between 0 and size() - 1) of the thread running it, thread 0 is the caller.
+		 */
+		void parallelFor(int count, function<void(int, int)> body)
+		{
+			int helpers = min((int)workers.size(), count - 1);
+
+			if(helpers <= 0)
+			{
+				for(int i = 0; i < count; i++)
+				{
+					body(i, 0);
+				}
+
+				return;
+			}
+
+			shared_ptr<Job> job = make_shared<Job>();
+			job->body = body;
+			job->count = count;
+			job->next = 0;
+			job->done = 0;
+
+			for(int h = 1; h <= helpers; h++)
+			{
+				submit([job, h]()
+				{
+					job->run(h);
+				});
+			}
+
+			job->run(0);
+
+			unique_lock<mutex> lock(job->doneMutex);
+			while(job->done.load() < count)
+			{
+				job->doneCondition.wait(lock);
+			}
+		}
+
+	private:
+		/**
+		 * Work shared by parallelFor between the threads.
+		 * Kept alive by the tasks so that late helpers find it exhausted and return.
+		 */
+		struct Job
+		{
+			function<void(int, int)> body;
+			int count;
+			atomic<int> next;
+			atomic<int> done;
+			mutex doneMutex;
+			condition_variable doneCondition;
+
+			void run(int worker)
+			{
+				int i;
+
+				while((i = next.fetch_add(1)) < count)
+				{
+					body(i, worker);
+
+					if(done.fetch_add(1) + 1 == count)
+					{
+						unique_lock<mutex> lock(doneMutex);
+						doneCondition.notify_all();
+					}
+				}
+			}
+		};
+
+		/**
+		 * Worker loop, runs tasks from the queue until the pool is destroyed.
+		 */
+		void work()
+		{
+			while(true)
+			{
+				function<void()> task;
+
+				{
+					unique_lock<mutex> lock(queueMutex);
+
+					while(running && tasks.empty())
+					{
+						queueCondition.wait(lock);
+					}
+
+					if(!running && tasks.empty())
+					{
+						return;
+					}
+
+					task = tasks.front();
+					tasks.pop_front();
+				}
+
+				task();
+			}
+		}
+
+		/**
+		 * Worker threads.
+		 */
+		vector<thread> workers;
+
+		/**
+		 * Tasks waiting to be executed.
+		 */
+		deque<function<void()>> tasks;
+
+		/**
+		 * Mutex protecting the task queue.
+		 */
+		mutex queueMutex;
+
+		/**
+		 * Signals workers when tasks are added.
+		 */
+		condition_variable queueCondition;
+
+		/**
+		 * Flag set to false when the pool is destroyed.
+		 */
+		bool running;
+};
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "../BatchDetector.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Measure the throughput of the batch detector for a number of streams.
+ * Each stream is a camera that gets a copy of the frame in every batch, the first batch is not measured (buffers are allocated).
+ * @param frame Frame used for all the streams.
+ * @param streams Number of streams (cameras).
+ * @param threads Number of threads of the batch pool (0 for the number of cores).
+ * @param batches Number of batches measured.
+ * @return Aggregate frames per second of all the streams.
+ */
+double throughput(Mat frame, int streams, unsigned int threads, int batches)
+{
+	BatchDetector batch(threads);
+	vector<BatchFrame> frames;
+
+	for(int i = 0; i < streams; i++)
+	{
+		frames.push_back(BatchFrame(frame.clone(), i, 0.0));
+	}
+
+	batch.detect(frames);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	for(int b = 0; b < batches; b++)
+	{
+		batch.detect(frames);
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	return streams * batches / seconds;
+}
+
+/**
+ * Prints the aggregate frames per second of the batch detector for 1 to 16 streams of the same image.
+ *
+ * Usage: aruco_batch_benchmark image [threads] [batches]
+ *
+ * @param argc Number of arguments.
+ * @param argv Value of the arguments.
+ */
+int main(int argc, char **argv)
+{
+	if(argc < 2)
+	{
+		cerr << "Usage: " << argv[0] << " image [threads] [batches]" << endl;
+		return 1;
+	}
+
+	Mat frame = imread(argv[1]);
+	if(frame.empty())
+	{
+		cerr << "Failed to read image " << argv[1] << endl;
+		return 1;
+	}
+
+	unsigned int threads = argc > 2 ? atoi(argv[2]) : 0;
+	int batches = argc > 3 ? atoi(argv[3]) : 50;
+
+	for(int streams = 1; streams <= 16; streams *= 2)
+	{
+		cout << streams << " streams: " << throughput(frame, streams, threads, batches) << " fps" << endl;
+	}
+
+	return 0;
+}
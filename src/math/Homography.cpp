@@ -0,0 +1,115 @@
+#pragma once
+
+#include <iostream>
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Planar homography represented by a 3x3 matrix stored by rows.
+ * Provides the closed form mapping from the unit square to a quad, avoiding the linear system solved by getPerspectiveTransform.
+ */
+class Homography
+{
+	public:
+		/**
+		 * Matrix values stored by rows.
+		 */
+		double h[9];
+
+		/**
+		 * Identity homography constructor.
+		 */
+		Homography()
+		{
+			for(int i = 0; i < 9; i++)
+			{
+				h[i] = (i % 4 == 0) ? 1.0 : 0.0;
+			}
+		}
+
+		/**
+		 * Map point using the homography.
+		 * @param x Point x coordinate.
+		 * @param y Point y coordinate.
+		 * @return Mapped point.
+		 */
+		inline Point2d apply(double x, double y) const
+		{
+			double w = 1.0 / (h[6] * x + h[7] * y + h[8]);
+			return Point2d((h[0] * x + h[1] * y + h[2]) * w, (h[3] * x + h[4] * y + h[5]) * w);
+		}
+
+		/**
+		 * Multiply two homographies, the result applies b first and then a.
+		 * @param a Homography a.
+		 * @param b Homography b.
+		 * @return Homography a * b.
+		 */
+		static Homography multiply(const Homography &a, const Homography &b)
+		{
+			Homography r;
+
+			for(int i = 0; i < 3; i++)
+			{
+				for(int j = 0; j < 3; j++)
+				{
+					r.h[i * 3 + j] = a.h[i * 3] * b.h[j] + a.h[i * 3 + 1] * b.h[3 + j] + a.h[i * 3 + 2] * b.h[6 + j];
+				}
+			}
+
+			return r;
+		}
+
+		/**
+		 * Calculate the homography that maps the unit square to a quad in closed form (Heckbert).
+		 * The unit square corners (0, 0), (1, 0), (1, 1), (0, 1) are mapped to the quad points 0, 1, 2 and 3.
+		 * @param quad Quad points.
+		 * @return Homography from the unit square to the quad.
+		 */
+		template<typename T> static Homography squareToQuad(const Point_<T> quad[4])
+		{
+			double x0 = quad[0].x, y0 = quad[0].y;
+			double x1 = quad[1].x, y1 = quad[1].y;
+			double x2 = quad[2].x, y2 = quad[2].y;
+			double x3 = quad[3].x, y3 = quad[3].y;
+
+			double sx = x0 - x1 + x2 - x3;
+			double sy = y0 - y1 + y2 - y3;
+
+			Homography r;
+			double *h = r.h;
+
+			//Parallelogram, the mapping is affine
+			if(sx == 0.0 && sy == 0.0)
+			{
+				h[0] = x1 - x0; h[1] = x3 - x0; h[2] = x0;
+				h[3] = y1 - y0; h[4] = y3 - y0; h[5] = y0;
+				h[6] = 0.0; h[7] = 0.0; h[8] = 1.0;
+				return r;
+			}
+
+			double dx1 = x1 - x2, dx2 = x3 - x2;
+			double dy1 = y1 - y2, dy2 = y3 - y2;
+			double den = dx1 * dy2 - dx2 * dy1;
+
+			double g = (sx * dy2 - dx2 * sy) / den;
+			double k = (dx1 * sy - sx * dy1) / den;
+
+			h[0] = x1 - x0 + g * x1; h[1] = x3 - x0 + k * x3; h[2] = x0;
+			h[3] = y1 - y0 + g * y1; h[4] = y3 - y0 + k * y3; h[5] = y0;
+			h[6] = g; h[7] = k; h[8] = 1.0;
+
+			return r;
+		}
+
+		/**
+		 * Print homography matrix to cout.
+		 */
+		void print()
+		{
+			cout << "[" << h[0] << ", " << h[1] << ", " << h[2] << "; " << h[3] << ", " << h[4] << ", " << h[5] << "; " << h[6] << ", " << h[7] << ", " << h[8] << "]" << endl;
+		}
+};
@@ -0,0 +1,439 @@
+#pragma once
+
+#include <vector>
+#include <math.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "Homography.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Pose of a planar object relative to the camera.
+ */
+class PlanarPose
+{
+	public:
+		/**
+		 * Rotation matrix stored by rows.
+		 */
+		double rotation[9];
+
+		/**
+		 * Translation vector.
+		 */
+		double translation[3];
+
+		/**
+		 * Root mean square reprojection error of the object corners in pixels.
+		 */
+		double error;
+
+		/**
+		 * Identity pose constructor.
+		 */
+		PlanarPose()
+		{
+			for(int i = 0; i < 9; i++)
+			{
+				rotation[i] = (i % 4 == 0) ? 1.0 : 0.0;
+			}
+
+			translation[0] = translation[1] = translation[2] = 0.0;
+			error = 0.0;
+		}
+
+		/**
+		 * Get the rotation as a Rodrigues vector (as returned by solvePnP).
+		 * @return 3x1 rotation vector.
+		 */
+		Mat rotationVector() const
+		{
+			Mat vector;
+			Rodrigues(Mat(3, 3, CV_64F, (void*)rotation), vector);
+			return vector;
+		}
+
+		/**
+		 * Get the translation vector (as returned by solvePnP).
+		 * @return 3x1 translation vector.
+		 */
+		Mat translationVector() const
+		{
+			return Mat(3, 1, CV_64F, (void*)translation).clone();
+		}
+};
+
+/**
+ * Closed form pose of square markers using infinitesimal plane-based pose estimation (IPPE, Collins and Bartoli 2014).
+ * The pose is obtained from the homography between the marker and the image, the rotation is recovered from the homography jacobian at the marker center.
+ * A planar target always has two possible rotations (flip ambiguity), both are returned ordered by reprojection error.
+ *
+ * Markers are solved in batches, the corners of all the markers are undistorted in a single call and stored as structure of arrays.
+ * The model is the marker square centered in the origin in the plane z = 0, with the same corner order as ArucoMarkerInfo: (-h, -h), (-h, h), (h, h), (h, -h).
+ */
+class PlanarPoseSolver
+{
+	public:
+		/**
+		 * Image corners of the markers to solve, 4 per marker.
+		 */
+		vector<Point2f> corners;
+
+		/**
+		 * Size (side) of each marker to solve.
+		 */
+		vector<double> sizes;
+
+		/**
+		 * Normalized (undistorted) x coordinate of the corners, 4 per marker.
+		 */
+		vector<double> x;
+
+		/**
+		 * Normalized (undistorted) y coordinate of the corners, 4 per marker.
+		 */
+		vector<double> y;
+
+		/**
+		 * Best pose (lowest reprojection error) of each marker.
+		 */
+		vector<PlanarPose> first;
+
+		/**
+		 * Alternative pose of each marker.
+		 */
+		vector<PlanarPose> second;
+
+		/**
+		 * Flag set for the markers with a valid pose.
+		 */
+		vector<unsigned char> valid;
+
+		/**
+		 * Remove all the markers from the batch.
+		 */
+		void clear()
+		{
+			corners.clear();
+			sizes.clear();
+		}
+
+		/**
+		 * Add a marker to the batch.
+		 * @param quad Image corners of the marker.
+		 * @param size Size (side) of the marker.
+		 */
+		void add(const Point2f quad[4], double size)
+		{
+			corners.insert(corners.end(), quad, quad + 4);
+			sizes.push_back(size);
+		}
+
+		/**
+		 * Solve the pose of all the markers in the batch, the results are stored in first, second and valid in the same order as the markers were added.
+		 * @param camera Camera intrinsic calibration matrix.
+		 * @param distortion Camera distortion coefficients (can be empty).
+		 * @return Number of markers solved.
+		 */
+		int solve(Mat camera, Mat distortion)
+		{
+			int count = sizes.size();
+
+			x.resize(count * 4);
+			y.resize(count * 4);
+
+			//Undistort all the corners at once
+			if(count > 0)
+			{
+				undistorted.resize(count * 4);
+				undistortPoints(corners, undistorted, camera, distortion);
+
+				for(int i = 0; i < count * 4; i++)
+				{
+					x[i] = undistorted[i].x;
+					y[i] = undistorted[i].y;
+				}
+			}
+
+			Mat intrinsic;
+			camera.convertTo(intrinsic, CV_64F);
+
+			return solveNormalized(intrinsic.at<double>(0, 0), intrinsic.at<double>(1, 1));
+		}
+
+		/**
+		 * Solve the pose of all the markers in the batch from corners already undistorted into x and y (e.g. by a CameraModel).
+		 * @param fx Focal length in x, used to express the reprojection error in pixels.
+		 * @param fy Focal length in y.
+		 * @return Number of markers solved.
+		 */
+		int solveNormalized(double fx, double fy)
+		{
+			int count = sizes.size();
+
+			first.resize(count);
+			second.resize(count);
+			valid.assign(count, 0);
+
+			int solved = 0;
+
+			for(int i = 0; i < count; i++)
+			{
+				valid[i] = solveSquare(&x[i * 4], &y[i * 4], sizes[i], fx, fy, first[i], second[i]);
+				solved += valid[i];
+			}
+
+			return solved;
+		}
+
+		/**
+		 * Solve the pose of one square marker from its normalized image corners.
+		 * @param x Normalized x coordinates of the 4 corners.
+		 * @param y Normalized y coordinates of the 4 corners.
+		 * @param size Size (side) of the marker.
+		 * @param fx Focal length in x, used to express the reprojection error in pixels.
+		 * @param fy Focal length in y.
+		 * @param first Pose with the lowest reprojection error.
+		 * @param second Alternative pose.
+		 * @return False if the corners are degenerate.
+		 */
+		static bool solveSquare(const double *x, const double *y, double size, double fx, double fy, PlanarPose &first, PlanarPose &second)
+		{
+			Point2d quad[4];
+			for(int i = 0; i < 4; i++)
+			{
+				quad[i] = Point2d(x[i], y[i]);
+			}
+
+			//Homography from the unit square, (a, b) = ((Y + h) / 2h, (X + h) / 2h) maps the model corners to the unit square corners
+			Homography square = Homography::squareToQuad(quad);
+			const double *s = square.h;
+			double half = size / 2.0;
+			double scale = 1.0 / size;
+
+			double h[9];
+			h[0] = s[1] * scale; h[1] = s[0] * scale; h[2] = (s[0] + s[1]) * 0.5 + s[2];
+			h[3] = s[4] * scale; h[4] = s[3] * scale; h[5] = (s[3] + s[4]) * 0.5 + s[5];
+			h[6] = s[7] * scale; h[7] = s[6] * scale; h[8] = (s[6] + s[7]) * 0.5 + s[8];
+
+			if(fabs(h[8]) < 1e-12)
+			{
+				return false;
+			}
+
+			//Image of the marker center and jacobian of the homography at the center
+			double p = h[2] / h[8];
+			double q = h[5] / h[8];
+			double j00 = (h[0] - h[6] * p) / h[8];
+			double j01 = (h[1] - h[7] * p) / h[8];
+			double j10 = (h[3] - h[6] * q) / h[8];
+			double j11 = (h[4] - h[7] * q) / h[8];
+
+			double r1[9], r2[9];
+			if(!computeRotations(j00, j01, j10, j11, p, q, r1, r2))
+			{
+				return false;
+			}
+
+			double mx[4] = {-half, -half, half, half};
+			double my[4] = {-half, half, half, -half};
+
+			computeTranslation(mx, my, x, y, r1, first.translation);
+			computeTranslation(mx, my, x, y, r2, second.translation);
+
+			for(int i = 0; i < 9; i++)
+			{
+				first.rotation[i] = r1[i];
+				second.rotation[i] = r2[i];
+			}
+
+			first.error = reprojectionError(mx, my, x, y, first, fx, fy);
+			second.error = reprojectionError(mx, my, x, y, second, fx, fy);
+
+			if(second.error < first.error)
+			{
+				swap(first, second);
+			}
+
+			return true;
+		}
+
+		/**
+		 * Compute the two rotations of a plane from the jacobian of its homography at a point (IPPE).
+		 * @param j00 Jacobian element (0, 0).
+		 * @param j01 Jacobian element (0, 1).
+		 * @param j10 Jacobian element (1, 0).
+		 * @param j11 Jacobian element (1, 1).
+		 * @param p Normalized x coordinate of the point.
+		 * @param q Normalized y coordinate of the point.
+		 * @param r1 First rotation matrix (by rows).
+		 * @param r2 Second rotation matrix (by rows).
+		 * @return False if the jacobian is degenerate.
+		 */
+		static bool computeRotations(double j00, double j01, double j10, double j11, double p, double q, double *r1, double *r2)
+		{
+			//Rotation that takes the viewing direction of the point to the z axis (transposed)
+			double norm = sqrt(p * p + q * q + 1.0);
+			double ax = p / norm;
+			double ay = q / norm;
+			double d = 1.0 / (1.0 + 1.0 / norm);
+
+			double rv00 = 1.0 - ax * ax * d, rv01 = -ax * ay * d, rv02 = ax;
+			double rv10 = -ax * ay * d, rv11 = 1.0 - ay * ay * d, rv12 = ay;
+			double rv20 = -ax, rv21 = -ay, rv22 = 1.0 - (ax * ax + ay * ay) * d;
+
+			double b00 = rv00 - p * rv20;
+			double b01 = rv01 - p * rv21;
+			double b10 = rv10 - q * rv20;
+			double b11 = rv11 - q * rv21;
+
+			double determinant = b00 * b11 - b01 * b10;
+			if(fabs(determinant) < 1e-12)
+			{
+				return false;
+			}
+
+			double inverse = 1.0 / determinant;
+			double binv00 = inverse * b11;
+			double binv01 = -inverse * b01;
+			double binv10 = -inverse * b10;
+			double binv11 = inverse * b00;
+
+			double a00 = binv00 * j00 + binv01 * j10;
+			double a01 = binv00 * j01 + binv01 * j11;
+			double a10 = binv10 * j00 + binv11 * j10;
+			double a11 = binv10 * j01 + binv11 * j11;
+
+			//Largest singular value of A
+			double ata00 = a00 * a00 + a01 * a01;
+			double ata01 = a00 * a10 + a01 * a11;
+			double ata11 = a10 * a10 + a11 * a11;
+			double gamma = sqrt(0.5 * (ata00 + ata11 + sqrt((ata00 - ata11) * (ata00 - ata11) + 4.0 * ata01 * ata01)));
+
+			if(gamma < 1e-12)
+			{
+				return false;
+			}
+
+			double t00 = a00 / gamma;
+			double t01 = a01 / gamma;
+			double t10 = a10 / gamma;
+			double t11 = a11 / gamma;
+
+			double c0 = sqrt(max(1.0 - t00 * t00 - t10 * t10, 0.0));
+			double c1 = sqrt(max(1.0 - t01 * t01 - t11 * t11, 0.0));
+			if(-t00 * t01 - t10 * t11 < 0.0)
+			{
+				c1 = -c1;
+			}
+
+			double rv[9] = {rv00, rv01, rv02, rv10, rv11, rv12, rv20, rv21, rv22};
+			double z = t00 * t11 - t01 * t10;
+
+			for(int r = 0; r < 3; r++)
+			{
+				double v0 = rv[r * 3], v1 = rv[r * 3 + 1], v2 = rv[r * 3 + 2];
+
+				r1[r * 3] = t00 * v0 + t10 * v1 + c0 * v2;
+				r1[r * 3 + 1] = t01 * v0 + t11 * v1 + c1 * v2;
+				r1[r * 3 + 2] = (c1 * t10 - c0 * t11) * v0 + (c0 * t01 - c1 * t00) * v1 + z * v2;
+
+				r2[r * 3] = t00 * v0 + t10 * v1 - c0 * v2;
+				r2[r * 3 + 1] = t01 * v0 + t11 * v1 - c1 * v2;
+				r2[r * 3 + 2] = (c0 * t11 - c1 * t10) * v0 + (c1 * t00 - c0 * t01) * v1 + z * v2;
+			}
+
+			return true;
+		}
+
+		/**
+		 * Compute the translation that best fits the model points for a given rotation (linear least squares).
+		 * @param mx Model x coordinates (4 points in the plane z = 0).
+		 * @param my Model y coordinates.
+		 * @param x Normalized image x coordinates.
+		 * @param y Normalized image y coordinates.
+		 * @param r Rotation matrix (by rows).
+		 * @param t Output translation.
+		 */
+		static void computeTranslation(const double *mx, const double *my, const double *x, const double *y, const double *r, double *t)
+		{
+			//Normal equations of t_x - u t_z = u r_z - r_x and t_y - v t_z = v r_z - r_y
+			double su = 0.0, sv = 0.0, suv = 0.0;
+			double bx = 0.0, by = 0.0, bz = 0.0;
+
+			for(int i = 0; i < 4; i++)
+			{
+				double rx = r[0] * mx[i] + r[1] * my[i];
+				double ry = r[3] * mx[i] + r[4] * my[i];
+				double rz = r[6] * mx[i] + r[7] * my[i];
+
+				double ex = x[i] * rz - rx;
+				double ey = y[i] * rz - ry;
+
+				su += x[i];
+				sv += y[i];
+				suv += x[i] * x[i] + y[i] * y[i];
+
+				bx += ex;
+				by += ey;
+				bz -= x[i] * ex + y[i] * ey;
+			}
+
+			//Solve [4 0 -su; 0 4 -sv; -su -sv suv] t = b
+			double det = 4.0 * (4.0 * suv - sv * sv) - su * su * 4.0;
+			double inv = 1.0 / det;
+
+			double i00 = (4.0 * suv - sv * sv) * inv;
+			double i01 = (su * sv) * inv;
+			double i02 = (4.0 * su) * inv;
+			double i11 = (4.0 * suv - su * su) * inv;
+			double i12 = (4.0 * sv) * inv;
+			double i22 = 16.0 * inv;
+
+			t[0] = i00 * bx + i01 * by + i02 * bz;
+			t[1] = i01 * bx + i11 * by + i12 * bz;
+			t[2] = i02 * bx + i12 * by + i22 * bz;
+		}
+
+		/**
+		 * Root mean square reprojection error of the model points in pixels.
+		 * @param mx Model x coordinates.
+		 * @param my Model y coordinates.
+		 * @param x Normalized image x coordinates.
+		 * @param y Normalized image y coordinates.
+		 * @param pose Pose to evaluate.
+		 * @param fx Focal length in x.
+		 * @param fy Focal length in y.
+		 * @return Reprojection error in pixels.
+		 */
+		static double reprojectionError(const double *mx, const double *my, const double *x, const double *y, const PlanarPose &pose, double fx, double fy)
+		{
+			const double *r = pose.rotation;
+			const double *t = pose.translation;
+			double sum = 0.0;
+
+			for(int i = 0; i < 4; i++)
+			{
+				double px = r[0] * mx[i] + r[1] * my[i] + t[0];
+				double py = r[3] * mx[i] + r[4] * my[i] + t[1];
+				double pz = r[6] * mx[i] + r[7] * my[i] + t[2];
+
+				double dx = (px / pz - x[i]) * fx;
+				double dy = (py / pz - y[i]) * fy;
+				sum += dx * dx + dy * dy;
+			}
+
+			return sqrt(sum / 4.0);
+		}
+
+	private:
+		/**
+		 * Undistorted corners returned by undistortPoints.
+		 */
+		vector<Point2f> undistorted;
+};
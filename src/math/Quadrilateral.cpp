@@ -17,9 +17,10 @@ class Quadrilateral
 {
 	public:
 		/**
-		 * Vector of points that compose the quad.
+		 * Points that compose the quad.
+		 * Stored inline so that quads can be copied and stored without heap allocation.
 		 */
-		vector<Point2f> points;
+		Point2f points[4];
 
 		/**
 		 * Quad constructor initializes 4 points.
@@ -28,7 +29,7 @@ class Quadrilateral
 		{
 			for(int i = 0; i < 4; i++)
 			{
-				points.push_back(Point2f(0.0, 0.0));
+				points[i] = Point2f(0.0, 0.0);
 			}
 		}
 
@@ -37,10 +38,10 @@ class Quadrilateral
 		 */
 		Quadrilateral(Point2f a, Point2f b, Point2f c, Point2f d)
 		{
-			points.push_back(a);
-			points.push_back(b);
-			points.push_back(c);
-			points.push_back(d);
+			points[0] = a;
+			points[1] = b;
+			points[2] = c;
+			points[3] = d;
 		}
 		
 		/**
@@ -50,7 +51,7 @@ class Quadrilateral
 		 */
 		float area()
 		{
-			return contourArea(points);
+			return contourArea(Mat(4, 1, CV_32FC2, points));
 		}
 
 		/**
@@ -61,7 +62,59 @@ class Quadrilateral
 		 */
 		bool containsPoint(Point2f p)
 		{
-			return pointPolygonTest(points, p, false) >= 0.0;
+			return pointPolygonTest(Mat(4, 1, CV_32FC2, points), p, false) >= 0.0;
+		}
+
+		/**
+		 * Calculate the perimeter of this quad.
+		 *
+		 * @return Perimeter of this quad.
+		 */
+		float perimeter() const
+		{
+			float sum = 0.0f;
+
+			for(int j = 0; j < 4; j++)
+			{
+				Point2f d = points[(j + 1) % 4] - points[j];
+				sum += sqrt(d.x * d.x + d.y * d.y);
+			}
+
+			return sum;
+		}
+
+		/**
+		 * Check if this quad has the same corners as another quad.
+		 * The corners can start at any point and be in any direction.
+		 *
+		 * @param other Quad to compare.
+		 * @param tolerance Maximum distance between matching corners.
+		 * @return true if all corners match.
+		 */
+		bool matches(const Quadrilateral &other, float tolerance) const
+		{
+			float limit = tolerance * tolerance;
+
+			for(int shift = 0; shift < 4; shift++)
+			{
+				for(int direction = -1; direction <= 1; direction += 2)
+				{
+					bool match = true;
+
+					for(int j = 0; j < 4 && match; j++)
+					{
+						Point2f d = points[j] - other.points[(shift + direction * j + 4) % 4];
+						match = d.x * d.x + d.y * d.y <= limit;
+					}
+
+					if(match)
+					{
+						return true;
+					}
+				}
+			}
+
+			return false;
 		}
 
 		/**
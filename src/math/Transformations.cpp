@@ -40,4 +40,20 @@ class Transformations
 
 			return  rz * ry * rx;
 		}
+
+		/**
+		 * Calculate the rotation matrix of an euler rotation (same as rotationMatrix) without allocating matrices.
+		 * @param euler Euler rotation.
+		 * @param r Rotation matrix stored by rows.
+		 */
+		static void rotationMatrix(Point3d euler, double *r)
+		{
+			double cx = cos(euler.x), sx = sin(euler.x);
+			double cy = cos(euler.y), sy = sin(euler.y);
+			double cz = cos(euler.z), sz = sin(euler.z);
+
+			r[0] = cz * cy; r[1] = cz * sy * sx - sz * cx; r[2] = cz * sy * cx + sz * sx;
+			r[3] = sz * cy; r[4] = sz * sy * sx + cz * cx; r[5] = sz * sy * cx - cz * sx;
+			r[6] = -sy; r[7] = cy * sx; r[8] = cy * cx;
+		}
 };
@@ -0,0 +1,33 @@
+#include "nodelet/nodelet.h"
+#include "pluginlib/class_list_macros.h"
+
+#include "ArucoRosNode.cpp"
+
+namespace aruco
+{
+	/**
+	 * Aruco node packaged as a nodelet.
+	 *
+	 * When loaded in the same nodelet manager as the camera driver the images are received as the shared pointer published by the driver, without serialization or copies.
+	 * Parameters and output topics are the same as the standalone node, in the private namespace of the nodelet (name the nodelet aruco to keep the same names).
+	 */
+	class ArucoNodelet : public nodelet::Nodelet
+	{
+		public:
+			/**
+			 * Node instance, shutdown when the nodelet is unloaded.
+			 */
+			ArucoRosNode node;
+
+		private:
+			/**
+			 * Initialize the node with the private node handle of the nodelet.
+			 */
+			virtual void onInit()
+			{
+				node.init(getPrivateNodeHandle());
+			}
+	};
+}
+
+PLUGINLIB_EXPORT_CLASS(aruco::ArucoNodelet, nodelet::Nodelet)
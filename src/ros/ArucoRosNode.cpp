@@ -0,0 +1,1280 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/photo/photo.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "ros/ros.h"
+
+#include "std_msgs/String.h"
+#include "std_msgs/Bool.h"
+#include "std_msgs/Int32.h"
+
+#include "geometry_msgs/Point.h"
+#include "geometry_msgs/PoseStamped.h"
+#include "sensor_msgs/image_encodings.h"
+#include "nav_msgs/Odometry.h"
+
+#include "image_transport/image_transport.h"
+#include "cv_bridge/cv_bridge.h"
+
+#include "aruco/Marker.h"
+#include "aruco/Diagnostics.h"
+
+#include "../ArucoMarker.cpp"
+#include "../ArucoMarkerInfo.cpp"
+#include "../ArucoDetector.cpp"
+#include "../StreamDetector.cpp"
+#include "../MultiMarkerPose.cpp"
+#include "../CameraModel.cpp"
+#include "../MarkerRegistry.cpp"
+#include "../MarkerMap.cpp"
+#include "../FairScheduler.cpp"
+#include "MarkerParams.cpp"
+#include "ImageMessage.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Aruco ROS node, detects the markers in the camera frames and publishes the camera pose calculated from the known markers.
+ * Used by the standalone aruco node and by the aruco nodelet.
+ */
+class ArucoRosNode
+{
+	public:
+		/**
+		 * Camera calibration matrix pre initialized with calibration values for the test camera.
+		 */
+		double data_calibration[9] = {570.3422241210938, 0, 319.5, 0, 570.3422241210938, 239.5, 0, 0, 1};
+		Mat calibration;
+
+		/**
+		 * Lenses distortion matrix initialized with values for the test camera.
+		 */
+		double data_distortion[5] = {0, 0, 0, 0, 0};
+		Mat distortion;
+
+		/**
+		 * Camera model used to undistort the marker corners before the pose is estimated.
+		 * Rebuilt when calibration is received, supports pinhole and fisheye (equidistant) lenses.
+		 */
+		CameraModel camera_model;
+
+		/**
+		 * Known markers indexed by id, to get the absolute position and rotation of the camera, some of these are required.
+		 * Markers can be registered and removed while frames are processed, each frame uses a snapshot of the registry.
+		 * Can be shared by the nodes of several cameras.
+		 */
+		shared_ptr<MarkerRegistry> known = make_shared<MarkerRegistry>();
+
+		/**
+		 * Protects the calibration and the pose estimator, used from the pose stage thread when streaming.
+		 */
+		mutex calibration_mutex;
+
+		/**
+		 * Node visibility publisher.
+		 * Publishes true when a known marker is visible, publishes false otherwise.
+		 */
+		ros::Publisher pub_visible;
+
+		/**
+		 * Node position publisher.
+		 */
+		ros::Publisher pub_position;
+
+		/**
+		 * Node rotation publisher.
+		 */
+		ros::Publisher pub_rotation;
+
+		/**
+		 * Node pose publisher.
+		 */
+		ros::Publisher pub_pose;
+
+		/**
+		 * Node odometry publisher.
+		 * Publishes the odometry of the tf_frame indicated using the pose calculated from marker.
+		 */
+		ros::Publisher pub_odom;
+
+		/**
+		 * Diagnostics publisher.
+		 * Publishes the latency, stage times and candidates of each frame, only when subscribed.
+		 */
+		ros::Publisher pub_diagnostics;
+
+		/**
+		 * Name of the transform tf name to indicate on published topics.
+		 */
+		string tf_frame_id;
+
+		/**
+		 * Pose publisher sequence counter.
+		 */
+		int pub_pose_seq = 0;
+
+		/**
+		 * Diagnostics publisher sequence counter.
+		 */
+		int pub_diagnostics_seq = 0;
+
+		/**
+		 * Duration in seconds of the window of recent frames used for the diagnostics percentiles.
+		 * By default 10 seconds are used.
+		 */
+		float diagnostics_window;
+
+		/**
+		 * Latency and stage times of the recent frames, in the order of the diagnostics message percentiles.
+		 * Always collected, used only from the thread that publishes the pose.
+		 */
+		RollingHistogram diagnostics[8];
+
+		/**
+		 * Flag to check if calibration parameters were received.
+		 * If set to false the camera will be calibrated when a camera info message is received.
+		 */
+		bool calibrated;
+
+		/**
+		 * Flag to determine if OpenCV or ROS coordinates are used.
+		 */
+		bool use_opencv_coords;
+
+		/**
+		 * When debug parameter is se to true the node creates a new cv window to show debug information.
+		 * By default is set to false.
+		 * If set true the node will open a debug window.
+		 */
+		bool debug;
+
+		/**
+		 * Cosine limit used during the quad detection phase.
+		 * Value between 0 and 1.
+		 * By default 0.8 is used.
+		 * The bigger the value more distortion tolerant the square detection will be.
+		 */
+		float cosine_limit;
+
+		/**
+		 * Maximum error to be used by geometry poly aproximation method in the quad detection phase.
+		 * By default 0.035 is used.
+		 */
+		float max_error_quad;
+
+		/**
+		 * Adaptive theshold pre processing block size.
+		 */
+		int theshold_block_size;
+
+		/**
+		 * Minimum threshold block size.
+		 * By default 5 is used.
+		 */
+		int theshold_block_size_min;
+
+		/**
+		 * Maximum threshold block size.
+		 * By default 9 is used.
+		 */
+		int theshold_block_size_max;
+
+		/**
+		 * Number of threshold block sizes (evenly spaced between the min and max) used in each frame.
+		 * Quads found with all the block sizes are merged, with 1 a single block size is used and it changes when no markers are found.
+		 * By default 4 is used.
+		 */
+		int threshold_block_count;
+
+		/**
+		 * Number of threads used to decode marker candidates.
+		 * By default 1 is used.
+		 */
+		int threads;
+
+		/**
+		 * Decimation factor used to search quads (1, 2 or 4).
+		 * Quads are searched in the downscaled image and refined in full resolution, the smallest marker detected is 14 * decimation pixels wide.
+		 * By default 1 is used (no decimation).
+		 */
+		int decimation;
+
+		/**
+		 * Maximum marker size in pixels, larger contours are discarded.
+		 * By default 0 is used (no limit).
+		 */
+		int max_marker_size;
+
+		/**
+		 * Size of the tiles used to search quads in parallel, requires max_marker_size.
+		 * By default 0 is used (no tiling).
+		 */
+		int tile_size;
+
+		/**
+		 * If set the markers are tracked and only the regions around them are searched between full frame scans.
+		 * By default false is used.
+		 */
+		bool tracking;
+
+		/**
+		 * Maximum number of frames between full frame scans when tracking is enabled.
+		 * By default 30 is used.
+		 */
+		int full_scan_interval;
+
+		/**
+		 * If set the corners of the markers are refined with subpixel precision before the pose is estimated.
+		 */
+		bool refine_corners;
+
+		/**
+		 * If set quads nested inside a decoded marker are not decoded.
+		 */
+		bool suppress_duplicates;
+
+		/**
+		 * If set the marker cells are sampled directly from the grayscale image instead of warping each candidate.
+		 * By default false is used.
+		 */
+		bool sample_cells;
+
+		/**
+		 * Maximum number of wrong marker cells corrected when decoding (between 0 and 2).
+		 * By default 0 is used.
+		 */
+		int error_correction;
+
+		/**
+		 * File with the code words of an extra marker family decoded together with the aruco markers.
+		 * By default empty, only aruco markers are decoded.
+		 */
+		string family_file;
+
+		/**
+		 * Number of data cells per side of the extra marker family (between 3 and 6).
+		 * By default 6 is used.
+		 */
+		int family_cells;
+
+		/**
+		 * If set the code words in the family file store the first cell in the most significant bit.
+		 * By default false is used.
+		 */
+		bool family_msb_first;
+
+		/**
+		 * Right shift used to reduce 16 bit images (mono16) to 8 bit, 8 for images that use the full 16 bits and 4 for 12 bit cameras.
+		 * By default 8 is used.
+		 */
+		int depth_shift;
+
+		/**
+		 * Minimum area considered for aruco markers.
+		 * Should be a value high enough to filter blobs out but detect the smallest marker necessary.
+		 * By default 100 is used.
+		 */
+		int min_area;
+
+		/**
+		 * If set frames are processed by the stream detector pipeline, the image callback only submits the frame.
+		 * When processing falls behind the oldest frames are dropped. The debug window is not available in this mode.
+		 */
+		bool streaming;
+
+		/**
+		 * Capacity of the queue before each stage of the streaming pipeline.
+		 */
+		int stream_queue_size;
+
+		/**
+		 * Maximum reprojection error of a known marker (in pixels) to be used in the camera pose.
+		 * Markers that disagree with the other markers (misdecoded or moved) are ignored.
+		 * By default 4.0 is used.
+		 */
+		float pose_inlier_threshold;
+
+		/**
+		 * Maximum number of refinement iterations of the camera pose.
+		 * By default 10 is used.
+		 */
+		int pose_max_iterations;
+
+		/**
+		 * If set the camera pose of the previous frame is used as starting point for the pose of the next frame.
+		 * By default true is used.
+		 */
+		bool pose_warm_start;
+
+		/**
+		 * Camera pose estimator, keeps the last pose to warm start the next frame.
+		 */
+		MultiMarkerPose multi_pose;
+
+		/**
+		 * Number of poses estimated, total refinement iterations and total solve time, printed when the node exits.
+		 */
+		long pose_count = 0;
+		long pose_iterations = 0;
+		double pose_time = 0.0;
+
+		/**
+		 * Aruco detector instance, keeps its buffers across frames.
+		 */
+		ArucoDetector detector;
+
+		/**
+		 * Stream detector used when streaming is enabled.
+		 */
+		StreamDetector stream;
+
+		/**
+		 * Latency from the capture of each frame (image header stamp) to the publication of its pose, printed when the node exits.
+		 * Includes the transport of the image, so it can be used to compare the standalone node with the nodelet.
+		 */
+		LatencyHistogram frame_latency;
+
+		/**
+		 * Image transport and subscribers, released when the node is shutdown.
+		 */
+		shared_ptr<image_transport::ImageTransport> transport;
+		image_transport::Subscriber sub_camera;
+		ros::Subscriber sub_camera_info;
+		ros::Subscriber sub_marker_register;
+		ros::Subscriber sub_marker_remove;
+		ros::Subscriber sub_marker_map;
+
+		/**
+		 * Maximum number of frames processed per second, frames received before the next frame is due are skipped.
+		 * By default 0 is used (no limit).
+		 */
+		float max_rate;
+
+		/**
+		 * Time when the next frame is due, when max_rate is set.
+		 */
+		chrono::steady_clock::time_point frame_due;
+
+		/**
+		 * Number of frames processed and skipped (max_rate), and total time waiting for the scheduler, printed when the node exits.
+		 */
+		long frame_count = 0;
+		atomic<long> frame_skipped{0};
+		double frame_wait = 0.0;
+
+		/**
+		 * Thread pool used by the detector, when set before initCamera() it is used instead of creating one with the threads param.
+		 * Shared by the cameras of the multi camera node.
+		 */
+		shared_ptr<ThreadPool> pool;
+
+		/**
+		 * Scheduler shared by the cameras of the multi camera node, limits the frames detected at the same time (NULL for no limit).
+		 */
+		shared_ptr<FairScheduler> scheduler;
+
+		/**
+		 * Name of the camera, printed with the statistics when not empty.
+		 */
+		string name;
+
+		/**
+		 * Set after init() until shutdown().
+		 */
+		bool initialized = false;
+
+		/**
+		 * Shutdown the node if it is still running.
+		 */
+		~ArucoRosNode()
+		{
+			shutdown();
+		}
+
+		/**
+		 * Draw yellow text with black outline into a frame.
+		 * @param frame Frame mat.
+		 * @param text Text to be drawn into the frame.
+		 * @param point Position of the text in frame coordinates.
+		 */
+		void drawText(Mat frame, string text, Point point)
+		{
+			putText(frame, text, point, FONT_HERSHEY_SIMPLEX, 0.5, Scalar(0, 0, 0), 2, CV_AA);
+			putText(frame, text, point, FONT_HERSHEY_SIMPLEX, 0.5, Scalar(0, 255, 255), 1, CV_AA);
+		}
+
+		/**
+		 * Fill the detection stage times and counters of the diagnostics of a frame.
+		 * @param message Diagnostics message.
+		 * @param timings Stage times of the detector.
+		 * @param conversion Time spent converting the image message.
+		 * @param contours Number of contours tested.
+		 * @param candidates Number of quads decoded.
+		 */
+		static void setTimings(aruco::Diagnostics &message, const FrameTimings &timings, double conversion, int contours, int candidates)
+		{
+			message.conversion = conversion + timings.convert;
+			message.threshold = timings.threshold;
+			message.contours = timings.contours;
+			message.quads = timings.quads;
+			message.decode = timings.decode;
+			message.contour_count = contours;
+			message.candidate_count = candidates;
+		}
+
+		/**
+		 * Add the latency and stage times of a frame to the recent frames and publish its diagnostics if the topic is subscribed.
+		 * @param message Diagnostics of the frame, the header is already set.
+		 * @param stamped If the frame has a capture time, frames without it are not counted in the latency percentiles.
+		 */
+		void publishDiagnostics(aruco::Diagnostics &message, bool stamped)
+		{
+			double times[8] = {message.latency, message.conversion, message.threshold, message.contours, message.quads, message.decode, message.pose, message.publish};
+			chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+			for(int i = stamped ? 0 : 1; i < 8; i++)
+			{
+				diagnostics[i].add(times[i], now);
+			}
+
+			if(pub_diagnostics.getNumSubscribers() == 0)
+			{
+				return;
+			}
+
+			message.header.seq = pub_diagnostics_seq++;
+			message.skipped = frame_skipped.load();
+			message.dropped = 0;
+
+			if(streaming)
+			{
+				for(int i = 0; i < StreamDetector::STAGES; i++)
+				{
+					message.dropped += stream.dropped[i].load();
+				}
+			}
+
+			for(int i = 0; i < 8; i++)
+			{
+				message.p50[i] = diagnostics[i].percentile(50);
+				message.p99[i] = diagnostics[i].percentile(99);
+			}
+
+			pub_diagnostics.publish(message);
+		}
+
+		/**
+		 * Estimate the camera pose from the known markers visible in a frame and publish it.
+		 * Called from the image callback or from the pose stage of the stream detector.
+		 * The outputs are stamped with the capture time of the frame, so the processing delay can be compensated downstream.
+		 * @param markers Markers found in the frame.
+		 * @param frame Frame where the markers and pose are drawn, empty to skip drawing.
+		 * @param stamp Capture time of the frame (image header stamp), the current time is used if the image is not stamped.
+		 * @param message_diagnostics Diagnostics of the frame with the detection stage times, the pose and publish times are added and it is published.
+		 * @return True if a known marker is visible.
+		 */
+		bool publishPose(vector<ArucoMarker> &markers, Mat frame, ros::Time stamp, aruco::Diagnostics &message_diagnostics)
+		{
+			lock_guard<mutex> lock(calibration_mutex);
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			//Frames from drivers that do not stamp the images are stamped when published
+			ros::Time time = stamp.isZero() ? ros::Time::now() : stamp;
+
+			//Visible
+			vector<ArucoMarker> found;
+
+			//Check known markers and attach their info, the registry ids are aruco ids (family 0) so markers of the extra family are not used for the pose
+			shared_ptr<const MarkerSnapshot> registered = known->snapshot();
+
+			for(unsigned int i = 0; i < markers.size(); i++)
+			{
+				const ArucoMarkerInfo *info = markers[i].family == 0 ? registered->find(markers[i].id) : NULL;
+
+				if(info != NULL)
+				{
+					markers[i].attachInfo(*info);
+					found.push_back(markers[i]);
+				}
+			}
+
+			//Draw markers
+			if(!frame.empty())
+			{
+				ArucoDetector::drawMarkers(frame, markers, calibration, distortion);
+			}
+
+			//Check if any marker was found, misplaced markers are rejected by the pose consensus
+			bool solved = found.size() > 0 && multi_pose.solve(found, camera_model);
+			message_diagnostics.pose = ArucoDetector::elapsed(start);
+
+			if(solved)
+			{
+				pose_count++;
+				pose_iterations += multi_pose.iterations;
+				pose_time += multi_pose.time;
+
+				//Calculate position and rotation
+				Mat rotation = multi_pose.pose.rotationVector();
+				Mat position = multi_pose.pose.translationVector();
+
+				//Invert position and rotation to get camera coords
+				Mat rodrigues;
+				Rodrigues(rotation, rodrigues);
+
+				Mat camera_rotation;
+				Rodrigues(rodrigues.t(), camera_rotation);
+
+				Mat camera_position = -rodrigues.t() * position;
+
+				//Publish position and rotation
+				geometry_msgs::Point message_position, message_rotation;
+
+				//OpenCV coordinates
+				if(use_opencv_coords)
+				{
+					message_position.x = camera_position.at<double>(0, 0);
+					message_position.y = camera_position.at<double>(1, 0);
+					message_position.z = camera_position.at<double>(2, 0);
+
+					message_rotation.x = camera_rotation.at<double>(0, 0);
+					message_rotation.y = camera_rotation.at<double>(1, 0);
+					message_rotation.z = camera_rotation.at<double>(2, 0);
+				}
+				//Robot coordinates
+				else
+				{
+					message_position.x = camera_position.at<double>(2, 0);
+					message_position.y = -camera_position.at<double>(0, 0);
+					message_position.z = -camera_position.at<double>(1, 0);
+
+					message_rotation.x = camera_rotation.at<double>(2, 0);
+					message_rotation.y = -camera_rotation.at<double>(0, 0);
+					message_rotation.z = -camera_rotation.at<double>(1, 0);
+				}
+
+				pub_position.publish(message_position);
+				pub_rotation.publish(message_rotation);
+
+				//Publish pose
+				geometry_msgs::PoseStamped message_pose;
+
+				//Header
+				message_pose.header.frame_id = tf_frame_id;
+				message_pose.header.seq = pub_pose_seq++;
+				message_pose.header.stamp = time;
+
+				//Position
+				message_pose.pose.position.x = message_position.x;
+				message_pose.pose.position.y = message_position.y;
+				message_pose.pose.position.z = message_position.z;
+
+				//Convert to quaternion
+				double x = message_rotation.x;
+				double y = message_rotation.y;
+				double z = message_rotation.z;
+
+				//Module of angular velocity
+				double angle = sqrt(x*x + y*y + z*z);
+				if(angle > 0.0)
+				{
+					message_pose.pose.orientation.x = x * sin(angle/2.0)/angle;
+					message_pose.pose.orientation.y = y * sin(angle/2.0)/angle;
+					message_pose.pose.orientation.z = z * sin(angle/2.0)/angle;
+					message_pose.pose.orientation.w = cos(angle/2.0);
+				}
+				//To avoid illegal expressions
+				else
+				{
+					message_pose.pose.orientation.x = 0.0;
+					message_pose.pose.orientation.y = 0.0;
+					message_pose.pose.orientation.z = 0.0;
+					message_pose.pose.orientation.w = 1.0;
+				}
+
+				pub_pose.publish(message_pose);
+
+				nav_msgs::Odometry message_odometry;
+				message_odometry.header.frame_id = tf_frame_id;
+				message_odometry.header.stamp = time;
+				message_odometry.pose.pose = message_pose.pose;
+				pub_odom.publish(message_odometry);
+
+				//Debug
+				if(!frame.empty())
+				{
+					//Markers used in the pose
+					for(unsigned int i = 0; i < found.size(); i++)
+					{
+						for(unsigned int j = 0; multi_pose.inlier[i] && j < 4; j++)
+						{
+							line(frame, found[i].projected[j], found[i].projected[(j + 1) % 4], Scalar(0, 150, 0), 2);
+						}
+					}
+
+					ArucoDetector::drawOrigin(frame, rotation, position, calibration, distortion, 0.1);
+
+					drawText(frame, "Position: " + to_string(message_position.x) + ", " + to_string(message_position.y) + ", " + to_string(message_position.z), Point2f(10, 180));
+					drawText(frame, "Rotation: " + to_string(message_rotation.x) + ", " + to_string(message_rotation.y) + ", " + to_string(message_rotation.z), Point2f(10, 200));
+					drawText(frame, "Pose: " + to_string(multi_pose.inliers) + " markers, " + to_string(multi_pose.outliers) + " rejected, " + to_string(multi_pose.iterations) + " iterations, " + to_string(multi_pose.time * 1e3) + " ms", Point2f(10, 220));
+				}
+			}
+			else if(!frame.empty())
+			{
+				drawText(frame, "Position: unknown", Point2f(10, 180));
+				drawText(frame, "Rotation: unknown", Point2f(10, 200));
+			}
+
+			//Publish visible
+			std_msgs::Bool message_visible;
+			message_visible.data = multi_pose.valid && found.size() > 0;
+			pub_visible.publish(message_visible);
+
+			message_diagnostics.publish = ArucoDetector::elapsed(start);
+			message_diagnostics.latency = 0.0;
+
+			//Frames from drivers that do not stamp the images are not measured
+			if(!stamp.isZero())
+			{
+				message_diagnostics.latency = (ros::Time::now() - stamp).toSec();
+				frame_latency.add(message_diagnostics.latency);
+			}
+
+			message_diagnostics.header.frame_id = tf_frame_id;
+			message_diagnostics.header.stamp = time;
+			message_diagnostics.marker_count = markers.size();
+			publishDiagnostics(message_diagnostics, !stamp.isZero());
+
+			return message_visible.data;
+		}
+
+		/**
+		 * Callback executed every time a new camera frame is received.
+		 * This callback is used to process received images and publish messages with camera position data if any.
+		 */
+		void onFrame(const sensor_msgs::ImageConstPtr& msg)
+		{
+			try
+			{
+				//Frame rate target, the due time advances by one period for each frame processed
+				if(max_rate > 0.0)
+				{
+					chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+					if(now < frame_due)
+					{
+						frame_skipped++;
+						return;
+					}
+
+					chrono::steady_clock::duration period = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / max_rate));
+					frame_due = max(frame_due + period, now - period);
+				}
+
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+				//The detector reads the message data in its native format, when loaded as a nodelet the message is the one published by the driver
+				Mat frame;
+				PixelFormat format(PixelFormat::FORMAT_AUTO, depth_shift);
+				shared_ptr<const void> owner;
+
+				if(imageMessageToMat(msg, frame, format))
+				{
+					owner = shared_ptr<const void>(msg.get(), [msg](const void*){});
+				}
+				//Other encodings are converted to BGR
+				else
+				{
+					cv_bridge::CvImageConstPtr image = cv_bridge::toCvShare(msg, "bgr8");
+					frame = image->image;
+					format.format = PixelFormat::FORMAT_BGR;
+					owner = shared_ptr<const void>(image.get(), [image](const void*){});
+				}
+
+				double conversion = ArucoDetector::elapsed(start);
+
+				//The image is kept alive by the pipeline until the frame is processed
+				if(streaming)
+				{
+					stream.submit(frame, msg->header.stamp.toNSec(), owner, format, conversion);
+					return;
+				}
+
+				//Wait for a detection slot when the threads are shared with other cameras, the streaming stages take their own slots
+				FairScheduler::Slot slot(scheduler.get());
+				frame_wait += slot.wait;
+				frame_count++;
+
+				//Process image and get markers
+				detector.pixelFormat = format;
+				detector.limitCosine = cosine_limit;
+				detector.thresholdBlockSize = theshold_block_size;
+				detector.minArea = min_area;
+				detector.maxError = max_error_quad;
+
+				vector<ArucoMarker> &markers = detector.detect(frame);
+
+				if(markers.size() == 0 && threshold_block_count <= 1)
+				{
+					theshold_block_size += 2;
+
+					if(theshold_block_size > theshold_block_size_max)
+					{
+						theshold_block_size = theshold_block_size_min;
+					}
+				}
+
+				//The message can be shared with other subscribers, the debug drawing is done in a copy (in color only for BGR frames)
+				Mat display;
+				if(debug)
+				{
+					if(format.format == PixelFormat::FORMAT_BGR)
+					{
+						display = frame.clone();
+					}
+					else
+					{
+						cvtColor(detector.context.gray, display, COLOR_GRAY2BGR);
+					}
+				}
+
+				aruco::Diagnostics message_diagnostics;
+				setTimings(message_diagnostics, detector.context.timings, conversion, detector.context.squareStats.contours, detector.context.quads.size());
+
+				bool visible = publishPose(markers, display, msg->header.stamp, message_diagnostics);
+
+				//Debug info
+				if(debug)
+				{
+					drawText(display, "Aruco ROS Debug", Point2f(10, 20));
+					drawText(display, "OpenCV V" + to_string(CV_MAJOR_VERSION) + "." + to_string(CV_MINOR_VERSION), Point2f(10, 40));
+					drawText(display, "Cosine Limit (A-Q): " + to_string(cosine_limit), Point2f(10, 60));
+					drawText(display, "Threshold Block (W-S): " + to_string(theshold_block_size), Point2f(10, 80));
+					drawText(display, "Min Area (E-D): " + to_string(min_area), Point2f(10, 100));
+					drawText(display, "MaxError PolyDP (R-F): " + to_string(max_error_quad), Point2f(10, 120));
+					drawText(display, "Visible: " + to_string(visible), Point2f(10, 140));
+					drawText(display, "Calibrated: " + to_string(calibrated), Point2f(10, 160));
+
+					imshow("Aruco", display);
+
+					char key = (char) waitKey(1);
+
+					if(key == 'q')
+					{
+						cosine_limit += 0.05;
+					}
+					else if(key == 'a')
+					{
+						cosine_limit -= 0.05;
+					}
+
+					if(key == 'w' && theshold_block_size + 2 <= AdaptiveThreshold::MAX_BLOCK_SIZE)
+					{
+						theshold_block_size += 2;
+					}
+					else if(key == 's' && theshold_block_size > 3)
+					{
+						theshold_block_size -= 2;
+					}
+
+					if(key == 'r')
+					{
+						max_error_quad += 0.005;
+					}
+					else if(key == 'f')
+					{
+						max_error_quad -= 0.005;
+					}
+
+					if(key == 'e')
+					{
+						min_area += 50;
+					}
+					else if(key == 'd')
+					{
+						min_area -= 50;
+					}
+				}
+			}
+			catch(cv_bridge::Exception& e)
+			{
+				ROS_ERROR("Error getting image data");
+			}
+		}
+
+		/**
+		 * On camera info callback.
+		 * Used to receive camera calibration parameters.
+		 */
+		void onCameraInfo(const sensor_msgs::CameraInfo &msg)
+		{
+			lock_guard<mutex> lock(calibration_mutex);
+
+			if(!calibrated)
+			{
+				calibrated = true;
+
+				for(unsigned int i = 0; i < 9; i++)
+				{
+					calibration.at<double>(i / 3, i % 3) = msg.K[i];
+				}
+
+				bool fisheye = msg.distortion_model == "equidistant" || msg.distortion_model == "fisheye";
+
+				//The drawing functions only use the pinhole coefficients
+				for(unsigned int i = 0; i < 5; i++)
+				{
+					distortion.at<double>(0, i) = !fisheye && i < msg.D.size() ? msg.D[i] : 0.0;
+				}
+
+				camera_model.set(calibration, vector<double>(msg.D.begin(), msg.D.end()), fisheye ? CameraModel::MODEL_FISHEYE : CameraModel::MODEL_PINHOLE);
+				camera_model.build(Size(msg.width, msg.height));
+
+				if(debug)
+				{
+					cout << "Camera calibration param received" << endl;
+					cout << "Camera: " << calibration << endl;
+					cout << "Distortion: " << distortion << endl;
+				}
+			}
+		}
+
+		/**
+		 * Callback to register markers on the marker list.
+		 * This callback received a custom marker message.
+		 */
+		void onMarkerRegister(const aruco::Marker &msg)
+		{
+			if(!known->accepts(msg.id))
+			{
+				ROS_ERROR("Marker %d rejected, the id has to be between 0 and %d (max_marker_id).", msg.id, known->maxId);
+				return;
+			}
+
+			if(known->add(ArucoMarkerInfo(msg.id, msg.size, Point3d(msg.posx, msg.posy, msg.posz), Point3d(msg.rotx, msg.roty, msg.rotz))))
+			{
+				cout << "Marker " << to_string(msg.id) << " already exists, was replaced." << endl;
+			}
+			else
+			{
+				cout << "Marker " << to_string(msg.id) << " added." << endl;
+			}
+		}
+
+		/**
+		 * Callback to remove markers from the marker list.
+		 * Markers are removed by publishing the remove ID to the remove topic.
+		 */
+		void onMarkerRemove(const std_msgs::Int32 &msg)
+		{
+			if(known->remove(msg.data))
+			{
+				cout << "Marker " << to_string(msg.data) << " removed." << endl;
+			}
+		}
+
+		/**
+		 * Callback to reload the known markers from a binary marker map.
+		 * Receives the path of the map file, the markers registered before are replaced.
+		 */
+		void onMarkerMap(const std_msgs::String &msg)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			MarkerMap map;
+			if(!map.open(msg.data))
+			{
+				ROS_ERROR("Failed to load marker map from %s", msg.data.c_str());
+				return;
+			}
+
+			int rejected = 0;
+			int loaded = known->load(map, true, &rejected);
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			if(rejected > 0)
+			{
+				ROS_ERROR("%d markers of %s rejected, the ids have to be between 0 and %d (max_marker_id).", rejected, msg.data.c_str(), known->maxId);
+			}
+
+			cout << "Marker map " << msg.data << " loaded, " << loaded << " markers in " << seconds * 1e3 << " ms." << endl;
+		}
+
+		/**
+		 * Read the node parameters, load the known markers, advertise the output topics and subscribe the input topics.
+		 * Parameters are read from the node handle namespace (/aruco by default) and the outputs are advertised in it.
+		 * @param node Node handle, the private node handle when loaded as a nodelet.
+		 */
+		void init(ros::NodeHandle &node)
+		{
+			initMarkers(node);
+			initCamera(node);
+		}
+
+		/**
+		 * Load the known markers from the parameters and subscribe the topics used to register and remove markers.
+		 * @param node Node handle with the marker parameters.
+		 */
+		void initMarkers(ros::NodeHandle &node)
+		{
+			node.param<bool>("debug", debug, false);
+			node.param<bool>("use_opencv_coords", use_opencv_coords, false);
+			node.param<int>("max_marker_id", known->maxId, 4095);
+
+			//Aruco makers passed as parameters
+			vector<ArucoMarkerInfo> markers;
+			readMarkerParams(node, use_opencv_coords, markers);
+
+			for(unsigned int i = 0; i < markers.size(); i++)
+			{
+				if(!known->accepts(markers[i].id))
+				{
+					ROS_ERROR("Marker %d rejected, the id has to be between 0 and %d (max_marker_id).", markers[i].id, known->maxId);
+					continue;
+				}
+
+				known->add(markers[i]);
+			}
+
+			//Binary marker map, added to the markers passed as parameters
+			string marker_map;
+			node.param<string>("marker_map", marker_map, "");
+
+			if(marker_map != "")
+			{
+				MarkerMap map;
+
+				int rejected = 0;
+
+				if(map.open(marker_map))
+				{
+					known->load(map, false, &rejected);
+				}
+				else
+				{
+					ROS_ERROR("Failed to load marker map from %s", marker_map.c_str());
+				}
+
+				if(rejected > 0)
+				{
+					ROS_ERROR("%d markers of %s rejected, the ids have to be between 0 and %d (max_marker_id).", rejected, marker_map.c_str(), known->maxId);
+				}
+			}
+
+			//Print all known markers
+			if(debug)
+			{
+				known->print();
+			}
+
+			//Subscribed topic names
+			string topic_marker_register, topic_marker_remove, topic_marker_map;
+			node.param<string>("topic_marker_register", topic_marker_register, "/marker_register");
+			node.param<string>("topic_marker_remove", topic_marker_remove, "/marker_remove");
+			node.param<string>("topic_marker_map", topic_marker_map, "/marker_map");
+
+			//Subscribe topics
+			sub_marker_register = node.subscribe(topic_marker_register, 1, &ArucoRosNode::onMarkerRegister, this);
+			sub_marker_remove = node.subscribe(topic_marker_remove, 1, &ArucoRosNode::onMarkerRemove, this);
+			sub_marker_map = node.subscribe(topic_marker_map, 1, &ArucoRosNode::onMarkerMap, this);
+
+			initialized = true;
+		}
+
+		/**
+		 * Read the camera and detector parameters, advertise the output topics and subscribe the camera topics.
+		 * The known markers are not loaded, they are shared with the node that called initMarkers() when known is set to its registry.
+		 * @param node Node handle with the camera parameters, the outputs are advertised in its namespace.
+		 */
+		void initCamera(ros::NodeHandle &node)
+		{
+			//Parameters
+			node.param<bool>("debug", debug, false);
+			node.param<bool>("use_opencv_coords", use_opencv_coords, false);
+			node.param<float>("cosine_limit", cosine_limit, 0.7);
+			node.param<int>("theshold_block_size_min", theshold_block_size_min, 3);
+			node.param<int>("theshold_block_size_max", theshold_block_size_max, 21);
+			node.param<int>("threshold_block_count", threshold_block_count, 4);
+			node.param<float>("max_error_quad", max_error_quad, 0.035); 
+			node.param<int>("min_area", min_area, 100);
+			node.param<int>("depth_shift", depth_shift, 8);
+			node.param<bool>("calibrated", calibrated, false);
+			node.param<int>("threads", threads, 1);
+			node.param<int>("decimation", decimation, 1);
+			node.param<int>("max_marker_size", max_marker_size, 0);
+			node.param<int>("tile_size", tile_size, 0);
+			node.param<bool>("tracking", tracking, false);
+			node.param<int>("full_scan_interval", full_scan_interval, 30);
+			node.param<bool>("refine_corners", refine_corners, false);
+			node.param<bool>("suppress_duplicates", suppress_duplicates, true);
+			node.param<bool>("sample_cells", sample_cells, false);
+			node.param<int>("error_correction", error_correction, 0);
+			node.param<string>("family_file", family_file, "");
+			node.param<int>("family_cells", family_cells, 6);
+			node.param<bool>("family_msb_first", family_msb_first, false);
+			node.param<bool>("streaming", streaming, false);
+			node.param<int>("stream_queue_size", stream_queue_size, 2);
+			node.param<float>("pose_inlier_threshold", pose_inlier_threshold, 4.0);
+			node.param<int>("pose_max_iterations", pose_max_iterations, 10);
+			node.param<bool>("pose_warm_start", pose_warm_start, true);
+			node.param<float>("max_rate", max_rate, 0.0);
+			node.param<float>("diagnostics_window", diagnostics_window, 10.0);
+
+			//Block sizes supported by the adaptive threshold
+			int max_block_size = AdaptiveThreshold::MAX_BLOCK_SIZE;
+			if(theshold_block_size_min < 3 || theshold_block_size_max > max_block_size || theshold_block_size_min > theshold_block_size_max)
+			{
+				ROS_ERROR("Invalid threshold block sizes %d to %d, they have to be between 3 and %d.", theshold_block_size_min, theshold_block_size_max, max_block_size);
+				theshold_block_size_min = min(max(theshold_block_size_min, 3), max_block_size);
+				theshold_block_size_max = min(max(theshold_block_size_max, theshold_block_size_min), max_block_size);
+			}
+
+			//Initial threshold block size
+			theshold_block_size = (theshold_block_size_min + theshold_block_size_max) / 2;
+			if(theshold_block_size % 2 == 0)
+			{
+				theshold_block_size++;
+			}
+
+			//Decoding options
+			if(pool)
+			{
+				detector.setThreadPool(pool);
+			}
+			else
+			{
+				detector.threads = threads;
+			}
+
+			//Block sizes thresholded in each frame
+			for(int i = 0; threshold_block_count > 1 && i < threshold_block_count; i++)
+			{
+				int size = theshold_block_size_min + (theshold_block_size_max - theshold_block_size_min) * i / (threshold_block_count - 1);
+				detector.thresholdBlockSizes.push_back(max(size | 1, 3));
+			}
+
+			if(decimation != 1 && decimation != 2 && decimation != 4)
+			{
+				ROS_ERROR("Invalid decimation %d, it has to be 1, 2 or 4. Decimation disabled.", decimation);
+				decimation = 1;
+			}
+
+			detector.decimation = decimation;
+			detector.maxMarkerSize = max_marker_size;
+			detector.tileSize = tile_size;
+			detector.tracking = tracking;
+			detector.tracker.fullScanInterval = full_scan_interval;
+			detector.refineCorners = refine_corners;
+			detector.suppressDuplicates = suppress_duplicates;
+			detector.decodeMode = sample_cells ? ArucoDetector::DECODE_SAMPLE : ArucoDetector::DECODE_WARP;
+			detector.errorCorrection = error_correction;
+
+			//Camera pose options
+			multi_pose.inlierThreshold = pose_inlier_threshold;
+			multi_pose.maxIterations = pose_max_iterations;
+			multi_pose.warmStart = pose_warm_start;
+
+			//Extra marker family, decoded in the same pass as the aruco markers
+			if(family_file != "")
+			{
+				vector<uint64_t> codes = MarkerFamily::readCodes(family_file, family_cells * family_cells, family_msb_first);
+
+				detector.families.addAruco(error_correction);
+				if(detector.families.add(family_file, family_cells, codes, error_correction) < 0)
+				{
+					ROS_ERROR("Failed to load marker family from %s, it needs 1 to 1024 code words and 3 to 6 cells.", family_file.c_str());
+					detector.families.families.clear();
+				}
+			}
+
+			//Initialize calibration matrices
+			calibration = Mat(3, 3, CV_64F, data_calibration);
+			distortion = Mat(1, 5, CV_64F, data_distortion);
+
+			//Camera instrinsic calibration parameters
+			if(node.hasParam("calibration"))
+			{
+				string data;
+				node.param<string>("calibration", data, "");
+
+				double values[9];
+				stringToDoubleArray(data, values, 9, "_");
+
+				for(unsigned int i = 0; i < 9; i++)
+				{
+					calibration.at<double>(i / 3, i % 3) = values[i];
+				}
+
+				calibrated = true;
+			}
+
+			//Camera distortion calibration parameters
+			if(node.hasParam("distortion"))
+			{
+				string data;
+				node.param<string>("distortion", data, "");	
+
+				double values[5];
+				stringToDoubleArray(data, values, 5, "_");
+
+				for(unsigned int i = 0; i < 5; i++)
+				{
+					distortion.at<double>(0, i) = values[i];
+				}
+
+				calibrated = true;
+			}
+
+			//Camera model from the calibration parameters, replaced when camera info is received
+			camera_model.set(calibration, vector<double>(data_distortion, data_distortion + 5), CameraModel::MODEL_PINHOLE);
+			camera_model.build();
+
+			//Recent frames used for the diagnostics percentiles
+			for(int i = 0; i < 8; i++)
+			{
+				diagnostics[i].window = diagnostics_window;
+			}
+
+			//TF frame
+			node.param<string>("tf_frame_id", tf_frame_id, "robot");
+
+			//Subscribed topic names
+			string topic_camera, topic_camera_info;
+			node.param<string>("topic_camera", topic_camera, "/rgb/image");
+			node.param<string>("topic_camera_info", topic_camera_info, "/rgb/camera_info");
+
+			//Publish topic names
+			string topic_visible, topic_position, topic_rotation, topic_pose, topic_odom, topic_diagnostics;
+			node.param<string>("topic_visible", topic_visible, "/visible");
+			node.param<string>("topic_position", topic_position, "/position");
+			node.param<string>("topic_rotation", topic_rotation, "/rotation");
+			node.param<string>("topic_pose", topic_pose, "/pose");
+			node.param<string>("topic_odom", topic_odom, "/odom");
+			node.param<string>("topic_diagnostics", topic_diagnostics, "/diagnostics");
+
+			//Advertise topics
+			pub_visible = node.advertise<std_msgs::Bool>(node.getNamespace() + topic_visible, 10);
+			pub_position = node.advertise<geometry_msgs::Point>(node.getNamespace() + topic_position, 10);
+			pub_rotation = node.advertise<geometry_msgs::Point>(node.getNamespace() + topic_rotation, 10);
+			pub_pose = node.advertise<geometry_msgs::PoseStamped>(node.getNamespace() + topic_pose, 10);
+			pub_odom = node.advertise<nav_msgs::Odometry>(node.getNamespace() + topic_odom, 10);
+			pub_diagnostics = node.advertise<aruco::Diagnostics>(node.getNamespace() + topic_diagnostics, 10);
+
+			//Subscribe topics
+			transport = make_shared<image_transport::ImageTransport>(node);
+			sub_camera = transport->subscribe(topic_camera, 1, &ArucoRosNode::onFrame, this);
+			sub_camera_info = node.subscribe(topic_camera_info, 1, &ArucoRosNode::onCameraInfo, this);
+
+			//Streaming pipeline, uses the detector options as they are now
+			if(streaming)
+			{
+				detector.limitCosine = cosine_limit;
+				detector.thresholdBlockSize = theshold_block_size;
+				detector.minArea = min_area;
+				detector.maxError = max_error_quad;
+
+				stream.settings = detector;
+				stream.scheduler = scheduler;
+				stream.pose = [this](StreamResult &result)
+				{
+					aruco::Diagnostics message_diagnostics;
+					setTimings(message_diagnostics, result.timings, result.conversion, result.contours, result.candidates);
+
+					//The stamp is carried in nanoseconds so the outputs have exactly the stamp of the image
+					ros::Time stamp;
+					stamp.fromNSec(result.timestamp);
+
+					publishPose(result.markers, Mat(), stamp, message_diagnostics);
+				};
+				stream.error = [](const StreamResult &result, const string &message)
+				{
+					ROS_ERROR("Failed to process frame %lu: %s", result.sequence, message.c_str());
+				};
+
+				for(int i = 0; i < StreamDetector::STAGES; i++)
+				{
+					stream.capacities[i] = max(stream_queue_size, 1);
+				}
+
+				stream.start();
+			}
+
+			initialized = true;
+		}
+
+		/**
+		 * Stop the streaming pipeline, unsubscribe the topics and print the pose and latency statistics.
+		 * Called when the node exits or the nodelet is unloaded, can be called more than once.
+		 */
+		void shutdown()
+		{
+			if(!initialized)
+			{
+				return;
+			}
+
+			initialized = false;
+
+			sub_camera.shutdown();
+			sub_camera_info.shutdown();
+			sub_marker_register.shutdown();
+			sub_marker_remove.shutdown();
+			sub_marker_map.shutdown();
+
+			if(name != "")
+			{
+				cout << "Camera " << name << endl;
+			}
+
+			if(frame_count > 0)
+			{
+				cout << "Frames: " << frame_count << " processed, " << frame_skipped << " skipped, " << frame_wait / frame_count * 1e3 << " ms waiting per frame" << endl;
+			}
+
+			if(pose_count > 0)
+			{
+				cout << "Pose: " << (double)pose_iterations / pose_count << " iterations, " << pose_time / pose_count * 1e3 << " ms per frame" << endl;
+			}
+
+			if(frame_latency.count() > 0)
+			{
+				cout << "Frame to pose latency (p50, p99 ms): " << frame_latency.percentile(50) * 1e3 << ", " << frame_latency.percentile(99) * 1e3 << endl;
+			}
+
+			if(streaming)
+			{
+				stream.stop();
+
+				cout << "Stream latency (p50, p99 ms)" << endl;
+				for(int i = 0; i < StreamDetector::STAGES; i++)
+				{
+					cout << "    Stage " << i << ": " << stream.latency[i].percentile(50) * 1e3 << ", " << stream.latency[i].percentile(99) * 1e3 << " dropped " << stream.dropped[i] << endl;
+				}
+			}
+
+			//Printed after the stream is stopped, the pose stage adds to the recent frames
+			if(diagnostics[1].count() > 0)
+			{
+				const char *stages[8] = {"Latency", "Conversion", "Threshold", "Contours", "Quads", "Decode", "Pose", "Publish"};
+
+				cout << "Recent frames (p50, p99 ms)" << endl;
+				for(int i = 0; i < 8; i++)
+				{
+					cout << "    " << stages[i] << ": " << diagnostics[i].percentile(50) * 1e3 << ", " << diagnostics[i].percentile(99) * 1e3 << endl;
+				}
+			}
+		}
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+
+#include "sensor_msgs/Image.h"
+#include "sensor_msgs/image_encodings.h"
+
+#include "../PixelFormat.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Wrap the data of an image message in a frame without conversion or copies.
+ * Grayscale (8 and 16 bit), color, packed YUV 4:2:2, semi planar YUV 4:2:0 and 8 bit Bayer encodings are supported.
+ * The frame references the message data, the message has to be kept alive while the frame is used.
+ * @param msg Image message.
+ * @param frame Frame that references the message data.
+ * @param format Pixel format of the frame, the depth shift is not changed.
+ * @return False if the encoding is not supported, the image has to be converted.
+ */
+bool imageMessageToMat(const sensor_msgs::ImageConstPtr &msg, Mat &frame, PixelFormat &format)
+{
+	namespace enc = sensor_msgs::image_encodings;
+
+	const string &encoding = msg->encoding;
+	int type = -1;
+	int rows = msg->height;
+
+	if(encoding == enc::MONO8 || encoding == enc::TYPE_8UC1)
+	{
+		type = CV_8UC1;
+		format.format = PixelFormat::FORMAT_GRAY;
+	}
+	else if(encoding == enc::BGR8)
+	{
+		type = CV_8UC3;
+		format.format = PixelFormat::FORMAT_BGR;
+	}
+	else if(encoding == enc::RGB8)
+	{
+		type = CV_8UC3;
+		format.format = PixelFormat::FORMAT_RGB;
+	}
+	else if(encoding == enc::BGRA8)
+	{
+		type = CV_8UC4;
+		format.format = PixelFormat::FORMAT_BGRA;
+	}
+	else if(encoding == enc::RGBA8)
+	{
+		type = CV_8UC4;
+		format.format = PixelFormat::FORMAT_RGBA;
+	}
+	//Big endian 16 bit images are converted
+	else if((encoding == enc::MONO16 || encoding == enc::TYPE_16UC1) && !msg->is_bigendian)
+	{
+		type = CV_16UC1;
+		format.format = PixelFormat::FORMAT_GRAY16;
+	}
+	//The ROS yuv422 encoding is UYVY
+	else if(encoding == enc::YUV422)
+	{
+		type = CV_8UC2;
+		format.format = PixelFormat::FORMAT_UYVY;
+	}
+	else if(encoding == "yuv422_yuy2" || encoding == "yuyv")
+	{
+		type = CV_8UC2;
+		format.format = PixelFormat::FORMAT_YUYV;
+	}
+	//Chroma rows are after the luma rows
+	else if(encoding == "nv12" || encoding == "nv21")
+	{
+		type = CV_8UC1;
+		rows = msg->height * 3 / 2;
+		format.format = PixelFormat::FORMAT_NV12;
+	}
+	else if(encoding == enc::BAYER_RGGB8 || encoding == enc::BAYER_BGGR8 || encoding == enc::BAYER_GBRG8 || encoding == enc::BAYER_GRBG8)
+	{
+		type = CV_8UC1;
+		format.format = PixelFormat::FORMAT_BAYER;
+	}
+
+	if(type < 0 || msg->height == 0 || msg->step < msg->width * CV_ELEM_SIZE(type) || msg->data.size() < (size_t)msg->step * rows)
+	{
+		return false;
+	}
+
+	frame = Mat(rows, msg->width, type, (void*)msg->data.data(), msg->step);
+
+	return true;
+}
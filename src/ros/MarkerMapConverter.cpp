@@ -0,0 +1,47 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ros/ros.h"
+
+#include "../ArucoMarkerInfo.cpp"
+#include "../MarkerMap.cpp"
+#include "MarkerParams.cpp"
+
+using namespace std;
+
+/**
+ * Converts the markers passed as parameters (marker###, same format as the aruco node) to a binary marker map file.
+ * The map can be loaded by the aruco node with the marker_map parameter or published to the marker map topic.
+ *
+ * Parameters:
+ *  - output Path of the marker map file written.
+ *  - use_opencv_coords If set the marker values are in OpenCV coordinates, as in the aruco node.
+ *
+ * @param argc Number of arguments.
+ * @param argv Value of the arguments.
+ */
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "aruco_map");
+
+	ros::NodeHandle node("~");
+
+	string output;
+	bool use_opencv_coords;
+	node.param<string>("output", output, "markers.map");
+	node.param<bool>("use_opencv_coords", use_opencv_coords, false);
+
+	vector<ArucoMarkerInfo> markers;
+	readMarkerParams(node, use_opencv_coords, markers);
+
+	if(!MarkerMap::save(output, markers))
+	{
+		ROS_ERROR("Failed to write marker map to %s", output.c_str());
+		return 1;
+	}
+
+	cout << "Marker map " << output << " written with " << markers.size() << " markers." << endl;
+
+	return 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "ros/ros.h"
+
+#include "../ArucoMarkerInfo.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Converts a string with numeric values separated by a delimiter to an array of double values.
+ * If 0_1_2_3 and delimiter is _ array will contain {0, 1, 2, 3}.
+ * Values missing in the string are set to zero.
+ * @param data String to be converted
+ * @param values Array to store values on
+ * @param cout Number of elements in the string
+ * @param delimiter Separator element
+ * @return Array with values.
+ */
+void stringToDoubleArray(string data, double* values, unsigned int count, string delimiter)
+{
+	size_t pos = 0;
+	unsigned int k = 0;
+
+	while((pos = data.find(delimiter)) != string::npos && k < count)
+	{
+		string token = data.substr(0, pos);
+		values[k] = stod(token);
+		data.erase(0, pos + delimiter.length());
+		k++;
+	}
+
+	//Last value, not followed by a delimiter
+	if(k < count && !data.empty())
+	{
+		values[k] = stod(data);
+		k++;
+	}
+
+	for(; k < count; k++)
+	{
+		values[k] = 0.0;
+	}
+}
+
+/**
+ * Read the markers passed as parameters (marker###) of a node.
+ * All the parameters of the node namespace are read in a single request to the parameter server.
+ * Each marker is described as SIZE_POSX_POSY_POSZ_ROTX_ROTY_ROTZ.
+ * @param node Node handle with the marker parameters.
+ * @param opencvCoords If set the values are in OpenCV coordinates, otherwise they are in ROS coordinates and are converted.
+ * @param markers Markers read, with the world corners calculated.
+ * @return Number of markers read.
+ */
+int readMarkerParams(ros::NodeHandle &node, bool opencvCoords, vector<ArucoMarkerInfo> &markers)
+{
+	XmlRpc::XmlRpcValue params;
+
+	if(!node.getParam(node.getNamespace(), params) || params.getType() != XmlRpc::XmlRpcValue::TypeStruct)
+	{
+		return 0;
+	}
+
+	int read = 0;
+
+	for(XmlRpc::XmlRpcValue::iterator it = params.begin(); it != params.end(); it++)
+	{
+		const string &name = it->first;
+
+		if(name.compare(0, 6, "marker") != 0 || name.size() == 6 || name.find_first_not_of("0123456789", 6) != string::npos || it->second.getType() != XmlRpc::XmlRpcValue::TypeString)
+		{
+			continue;
+		}
+
+		int id = atoi(name.c_str() + 6);
+
+		double values[7];
+		stringToDoubleArray(static_cast<string>(it->second), values, 7, "_");
+
+		//Use OpenCV coordinates
+		if(opencvCoords)
+		{
+			markers.push_back(ArucoMarkerInfo(id, values[0], Point3d(values[1], values[2], values[3]), Point3d(values[4], values[5], values[6])));
+		}
+		//Convert coordinates (-Y, -Z, +X)
+		else
+		{
+			markers.push_back(ArucoMarkerInfo(id, values[0], Point3d(-values[2], -values[3], -values[1]), Point3d(-values[5], -values[6], values[4])));
+		}
+
+		read++;
+	}
+
+	return read;
+}
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "ros/ros.h"
+#include "ros/callback_queue.h"
+
+#include "ArucoRosNode.cpp"
+
+using namespace std;
+
+/**
+ * Camera served by the multi camera node.
+ */
+class CameraWorker
+{
+	public:
+		/**
+		 * Callback queue of the camera, its frames and camera info are processed in the camera thread.
+		 */
+		ros::CallbackQueue queue;
+
+		/**
+		 * Node of the camera, with its own calibration, detector and adaptive threshold state.
+		 */
+		ArucoRosNode node;
+
+		/**
+		 * Thread that serves the callback queue.
+		 */
+		unique_ptr<ros::AsyncSpinner> spinner;
+};
+
+/**
+ * Multi camera aruco node, one process serves the cameras listed in the cameras param.
+ *
+ * Each camera reads its params from its own namespace (/aruco/<camera>/) and publishes its pose there, the params are the same as the aruco node.
+ * The callbacks of each camera run in their own thread (callback queue), so the cameras are processed in parallel.
+ * The known markers (marker### and marker_map params, marker topics) are read from the /aruco namespace and shared by all the cameras.
+ * The detectors share one thread pool (threads param, 0 for one thread per core) and a scheduler that limits the frames detected at the same time to the pool size, granted first come first served between cameras.
+ * Cameras with streaming enabled use the same pool and scheduler, each stage of their pipeline takes a slot while it processes a frame.
+ * The frame rate of each camera can be limited with its max_rate param.
+ *
+ * @param argc Number of arguments.
+ * @param argv Value of the arguments.
+ */
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "aruco_multi");
+
+	//ROS node instance
+	ros::NodeHandle node("aruco");
+
+	vector<string> cameras;
+	if(!node.getParam("cameras", cameras) || cameras.empty())
+	{
+		ROS_ERROR("No cameras, set the cameras param with the list of camera namespaces");
+		return 1;
+	}
+
+	int threads;
+	node.param<int>("threads", threads, 0);
+
+	shared_ptr<ThreadPool> pool = make_shared<ThreadPool>(max(threads, 0));
+	shared_ptr<FairScheduler> scheduler = make_shared<FairScheduler>(pool->size());
+
+	//Known markers, served in the global callback queue
+	ArucoRosNode markers;
+	markers.initMarkers(node);
+
+	vector<unique_ptr<CameraWorker>> workers;
+
+	for(unsigned int i = 0; i < cameras.size(); i++)
+	{
+		unique_ptr<CameraWorker> worker(new CameraWorker());
+
+		ros::NodeHandle handle(node, cameras[i]);
+		handle.setCallbackQueue(&worker->queue);
+
+		worker->node.name = cameras[i];
+		worker->node.known = markers.known;
+		worker->node.pool = pool;
+		worker->node.scheduler = scheduler;
+		worker->node.initCamera(handle);
+
+		//The debug window can only be used from one thread
+		if(worker->node.debug && cameras.size() > 1)
+		{
+			cout << "Debug window disabled for camera " << cameras[i] << ", not available with multiple cameras." << endl;
+			worker->node.debug = false;
+		}
+
+		worker->spinner.reset(new ros::AsyncSpinner(1, &worker->queue));
+		worker->spinner->start();
+
+		workers.push_back(move(worker));
+	}
+
+	ros::spin();
+
+	for(unsigned int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->spinner->stop();
+	}
+
+	for(unsigned int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->node.shutdown();
+	}
+
+	markers.shutdown();
+
+	return 0;
+}
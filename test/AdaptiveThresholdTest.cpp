@@ -0,0 +1,124 @@
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "../src/AdaptiveThreshold.cpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * Random grayscale frame, the top half is almost flat so many pixels are close to the mean of their block.
+ */
+static Mat randomFrame(int rows, int cols, int seed)
+{
+	RNG rng(seed);
+
+	Mat frame(rows, cols, CV_8UC1);
+	rng.fill(frame, RNG::UNIFORM, 0, 256);
+	rng.fill(frame.rowRange(0, rows / 2), RNG::UNIFORM, 99, 102);
+
+	return frame;
+}
+
+/**
+ * Kernels supported by the CPU running the test.
+ */
+static vector<int> kernels()
+{
+	vector<int> list;
+	list.push_back(AdaptiveThreshold::KERNEL_SCALAR);
+
+	if(checkHardwareSupport(CV_CPU_SSE2))
+	{
+		list.push_back(AdaptiveThreshold::KERNEL_SSE2);
+	}
+
+	if(checkHardwareSupport(CV_CPU_AVX2))
+	{
+		list.push_back(AdaptiveThreshold::KERNEL_AVX2);
+	}
+
+	return list;
+}
+
+static const int BLOCK_SIZES[] = {3, 5, 11, 21, 51, 255};
+static const Size FRAME_SIZES[] = {Size(97, 61), Size(640, 480), Size(333, 129)};
+
+TEST(AdaptiveThreshold, MatchesOpenCVMeanThreshold)
+{
+	vector<int> list = kernels();
+	vector<int> sums, prefix;
+
+	for(int f = 0; f < 3; f++)
+	{
+		Mat frame = randomFrame(FRAME_SIZES[f].height, FRAME_SIZES[f].width, f + 1);
+
+		for(int b = 0; b < 6; b++)
+		{
+			Mat expected;
+			adaptiveThreshold(frame, expected, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY, BLOCK_SIZES[b], 0);
+
+			for(unsigned int k = 0; k < list.size(); k++)
+			{
+				Mat gray, binary;
+				AdaptiveThreshold::apply(frame, gray, binary, BLOCK_SIZES[b], sums, prefix, PixelFormat(), list[k]);
+
+				EXPECT_EQ(0, countNonZero(binary != expected)) << "Frame " << frame.cols << "x" << frame.rows << " block " << BLOCK_SIZES[b] << " kernel " << list[k];
+			}
+		}
+	}
+}
+
+TEST(AdaptiveThreshold, MultiMatchesOpenCVMeanThreshold)
+{
+	vector<int> list = kernels();
+	vector<int> blockSizes(BLOCK_SIZES, BLOCK_SIZES + 6);
+	vector<uint32_t> integral;
+	vector<int> prefix;
+	vector<Mat> binaries;
+
+	for(int f = 0; f < 3; f++)
+	{
+		Mat frame = randomFrame(FRAME_SIZES[f].height, FRAME_SIZES[f].width, f + 10);
+
+		for(unsigned int k = 0; k < list.size(); k++)
+		{
+			AdaptiveThreshold::applyMulti(frame, blockSizes, binaries, integral, prefix, list[k]);
+
+			for(unsigned int b = 0; b < blockSizes.size(); b++)
+			{
+				Mat expected;
+				adaptiveThreshold(frame, expected, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY, blockSizes[b], 0);
+
+				EXPECT_EQ(0, countNonZero(binaries[b] != expected)) << "Frame " << frame.cols << "x" << frame.rows << " block " << blockSizes[b] << " kernel " << list[k];
+			}
+		}
+	}
+}
+
+TEST(AdaptiveThreshold, ColorMatchesGrayscaleConversion)
+{
+	RNG rng(7);
+	Mat frame(240, 320, CV_8UC3);
+	rng.fill(frame, RNG::UNIFORM, 0, 256);
+
+	Mat gray, expected;
+	cvtColor(frame, gray, COLOR_BGR2GRAY);
+	adaptiveThreshold(gray, expected, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY, 21, 0);
+
+	Mat luma, binary;
+	AdaptiveThreshold::apply(frame, luma, binary, 21);
+
+	EXPECT_EQ(0, countNonZero(luma != gray));
+	EXPECT_EQ(0, countNonZero(binary != expected));
+}
+
+int main(int argc, char **argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}